@@ -1,56 +1,156 @@
 #pragma once
 
 #include "cl_wrapping.h"
-#include "Timer.h"
-
-#include <opencv2/opencv.hpp>
+#include "gaussian.h"
 
+#include <algorithm>
 #include <exception>
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <vector>
+
+// Splits a frame into tiles that fit the device image limits.
+// Every tile reads a tileWidth x tileHeight window of the frame, so a fixed set
+// of device images is reused for all of them. Windows are shifted inward at the
+// frame edges instead of shrinking : an edge tile's image border is then the
+// frame border, where the sampler clamp gives the same result as the untiled frame,
+// and every other core pixel has at least halo pixels of real neighbours.
+// bytesPerPixel is that of the widest per-tile buffer, which must stay under maxBytes.
+struct TileLayout
+{
+	struct Tile
+	{
+		int inputX, inputY;				// window origin in the frame
+		int coreX, coreY;				// output rectangle in the frame
+		int coreWidth, coreHeight;
+	};
+
+	TileLayout() = default;
+	TileLayout(int frameWidth, int frameHeight, int halo, size_t maxWidth, size_t maxHeight, cl_ulong maxBytes, int bytesPerPixel) :
+		frameWidth(frameWidth),
+		frameHeight(frameHeight)
+	{
+		tileWidth = (int)std::min((size_t)frameWidth, maxWidth);
+		tileHeight = (int)std::min((size_t)frameHeight, maxHeight);
+		if ((cl_ulong)tileWidth * tileHeight * bytesPerPixel > maxBytes) {
+			tileHeight = (int)(maxBytes / ((cl_ulong)tileWidth * bytesPerPixel));
+		}
+
+		// Halos are only needed along the axes that are actually split
+		coreWidth = tileWidth < frameWidth ? tileWidth - 2 * halo : frameWidth;
+		coreHeight = tileHeight < frameHeight ? tileHeight - 2 * halo : frameHeight;
+		if (coreWidth < 1 || coreHeight < 1) {
+			throw std::runtime_error("Device image limits are too small to tile the frame");
+		}
+
+		tilesX = (frameWidth + coreWidth - 1) / coreWidth;
+		tilesY = (frameHeight + coreHeight - 1) / coreHeight;
+	}
+
+	int count() const { return tilesX * tilesY; }
+	bool tiled() const { return count() > 1; }
+
+	Tile tile(int index) const
+	{
+		Tile t;
+		t.coreX = (index % tilesX) * coreWidth;
+		t.coreY = (index / tilesX) * coreHeight;
+		t.coreWidth = std::min(coreWidth, frameWidth - t.coreX);
+		t.coreHeight = std::min(coreHeight, frameHeight - t.coreY);
+		t.inputX = std::max(0, std::min(t.coreX - (tileWidth - coreWidth) / 2, frameWidth - tileWidth));
+		t.inputY = std::max(0, std::min(t.coreY - (tileHeight - coreHeight) / 2, frameHeight - tileHeight));
+
+		return t;
+	}
+
+	int frameWidth = 0;
+	int frameHeight = 0;
+	int tileWidth = 0;		// device image size
+	int tileHeight = 0;
+	int coreWidth = 0;		// output pixels per tile
+	int coreHeight = 0;
+	int tilesX = 1;
+	int tilesY = 1;
+};
 
 class CLContext
 {
 public:
+	// Layout of the edgeStats() result, see sobel_stats in Sobel.cl
+	static constexpr int STATS_GRID = 8;
+	static constexpr int STATS_BINS = 8;
+	static constexpr int STATS_EDGES = 0;
+	static constexpr int STATS_SUM_LOW = 1;
+	static constexpr int STATS_SUM_HIGH = 2;
+	static constexpr int STATS_ORIENTATION = 3;
+	static constexpr int STATS_REGIONS = STATS_ORIENTATION + STATS_BINS;
+	static constexpr int STATS_SIZE = STATS_REGIONS + STATS_GRID * STATS_GRID;
+
+	// Halo for canny() on tiled frames : 5x5 blur, 3x3 gradient, then suppression along the gradient
+	static constexpr int CANNY_HALO = 2 + 1 + 1;
+	// Edge state of a strong pixel in the canny kernels, weak ones are CANNY_WEAK in Sobel.cl
+	static constexpr unsigned char CANNY_STRONG = 255;
+
+	// Widest per-tile buffer : the packed canny gradient (colour frames take 3, images 1).
+	// Tiles are sized with it, which leaves room for the untiled pre-filter buffers (2 bytes plus their apron).
+	static constexpr int TILE_BYTES_PER_PIXEL = sizeof(cl_uint);
+
 	CLContext() = delete;
-	CLContext(int imgWidth, int imgHeight) :
+	// kernelName is built from sourcePath with buildOptions, and must take
+	// (read-only input image, write-only output image) as its arguments.
+	// halo is the kernel radius (CANNY_HALO for canny()). Frames beyond the device image limits
+	// are processed in tiles; maxTileSize (0 : device limits only) lowers the limits further.
+	CLContext(int imgWidth, int imgHeight, const std::string& sourcePath = "Sobel.cl", const std::string& kernelName = "sobel", const std::string& buildOptions = "",
+		int halo = 1, int maxTileSize = 0) :
 		imgWidth_(imgWidth),
 		imgHeight_(imgHeight)
 	{
-		cl_platform_id platform = 0;
 		try {
-			platform = findPlatform();
-			device_ = findDevice(platform);
-			context_ = cl::createContext(nullptr, 1, &device_, nullptr, nullptr);
+			device_ = findDevice();
+			context_ = cl::Context(cl::createContext(nullptr, 1, &device_, nullptr, nullptr));
 			//cl_command_queue_properties commandQueueProperties[] = { CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0 };
 			//commandQueue_ = cl::createCommandQueueWithProperties(context_, device_, commandQueueProperties);
-			commandQueue_ = clCreateCommandQueue(context_, device_, CL_QUEUE_PROFILING_ENABLE, NULL);
+			commandQueue_ = cl::CommandQueue(clCreateCommandQueue(context_, device_, CL_QUEUE_PROFILING_ENABLE, NULL));
+
+			char name[256] = {};
+			cl_device_type type = 0;
+			cl::getDeviceInfo(device_, CL_DEVICE_NAME, sizeof(name) - 1, name);
+			cl::getDeviceInfo(device_, CL_DEVICE_TYPE, sizeof(cl_device_type), &type);
+			deviceName_ = std::string(name) + ((type & CL_DEVICE_TYPE_GPU) ? " (GPU)" : (type & CL_DEVICE_TYPE_CPU) ? " (CPU)" : "");
+
+			size_t maxImageWidth = 0;
+			size_t maxImageHeight = 0;
+			cl_ulong maxAllocSize = 0;
+			cl::getDeviceInfo(device_, CL_DEVICE_IMAGE2D_MAX_WIDTH, sizeof(size_t), &maxImageWidth);
+			cl::getDeviceInfo(device_, CL_DEVICE_IMAGE2D_MAX_HEIGHT, sizeof(size_t), &maxImageHeight);
+			cl::getDeviceInfo(device_, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAllocSize);
+			if (maxTileSize > 0) {
+				maxImageWidth = std::min(maxImageWidth, (size_t)maxTileSize);
+				maxImageHeight = std::min(maxImageHeight, (size_t)maxTileSize);
+			}
+			tiles_ = TileLayout(imgWidth_, imgHeight_, halo, maxImageWidth, maxImageHeight, maxAllocSize, TILE_BYTES_PER_PIXEL);
 
-			sobelProgram_ = initProgram("Sobel.cl");
+			program_ = initTileProgram(sourcePath, buildOptions);
 
 			initImageBuffer();
-			initKernel();
-			cl::getKernelWorkGroupInfo(sobelKernel_, device_, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &preferredWorkgroupSize);
+			initKernel(kernelName);
+			cl::getKernelWorkGroupInfo(filterKernel_, device_, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &preferredWorkgroupSize);
 		}
 		catch (const std::exception& e) {
 			throw std::runtime_error(e.what());
 		}
 	}
 
-	~CLContext()
+	// Runs the filter kernel on a caller-owned 8-bit plane and writes the result into dst.
+	// Rows are transferred with the caller's pitch, so no host-side staging copy is made.
+	// Returns the kernel execution time in milliseconds.
+	double filter(const unsigned char* src, size_t srcPitch, unsigned char* dst, size_t dstPitch)
 	{
-		cl::releaseContext(context_);
-		cl::releaseDevice(device_);
-		cl::releaseCommandQueue(commandQueue_);
-		cl::releaseProgram(sobelProgram_);
-		cl::releaseKernel(sobelKernel_);
-		cl::releaseMemObject(inputImage_);
-		cl::releaseMemObject(outputImage_);
-	}
+		if (tiles_.tiled()) {
+			return filterTiles(src, srcPitch, dst, dstPitch);
+		}
 
-	void sobel(cv::UMat& frame, Timer& timer)
-	{
 		size_t workSizeX = (((size_t)imgWidth_ - 1) / preferredWorkgroupSize + 1) * preferredWorkgroupSize;
 		size_t globalWorkSize[] = { workSizeX, (size_t)imgHeight_ };
 		size_t localWorkSize[] = { preferredWorkgroupSize, 1 };
@@ -58,63 +158,481 @@ public:
 		size_t origin[] = { 0, 0, 0 };
 		size_t region[] = { (size_t)imgWidth_, (size_t)imgHeight_, 1 };
 
-		cl_event writeImage, sobel, readImage;
+		// Events live for one frame only and are released on every return path
+		cl::Event blurBegin, blurEnd, filter, readImage;
+		cl_event event;
+
+		try {
+			// The queue is in-order and the read blocks, so src only needs to stay valid until we return
+			enqueueInput(src, srcPitch, blurBegin, blurEnd);
+			cl::enqueueNDRangeKernel(commandQueue_, filterKernel_, 2, nullptr, globalWorkSize, localWorkSize, 0, nullptr, &event);
+			filter = cl::Event(event);
+			cl::enqueueReadImage(commandQueue_, outputImage_, CL_TRUE, origin, region, dstPitch, 0, dst, 1, filter.address(), &event);
+			readImage = cl::Event(event);
+			cl::waitForEvents(1, readImage.address());
+			cl::countTransfer(frameSize(), frameSize());
+		}
+		catch (const std::exception& e) {
+			throw std::runtime_error(e.what());
+		}
+
+		return blurTime(blurBegin, blurEnd) + profile(filter);
+	}
+
+	// Canny edge detection entirely on the device. Thresholds apply to the L2 gradient magnitude.
+	// Only the final edge map is read back; hysteresis additionally reads a 4-byte
+	// "changed" flag per pass to know when to stop.
+	// Tiled frames run blur, gradient and suppression per tile (CANNY_HALO) and park the
+	// edge states of every core in dst. Hysteresis then sweeps the tiles, each uploading
+	// its window of dst, until no tile promotes anything, so edges still connect across
+	// tiles while every device buffer stays tile-sized.
+	// Requires a program built from Sobel.cl. Returns the device time in milliseconds.
+	double canny(const unsigned char* src, size_t srcPitch, unsigned char* dst, size_t dstPitch, float lowThreshold, float highThreshold)
+	{
+		if (!cannyReady_) {
+			initCanny();
+		}
+
+		const TileLayout& layout = tiles_;
+		size_t workSizeX = (((size_t)layout.tileWidth - 1) / preferredWorkgroupSize + 1) * preferredWorkgroupSize;
+		size_t globalWorkSize[] = { workSizeX, (size_t)layout.tileHeight };
+		size_t localWorkSize[] = { preferredWorkgroupSize, 1 };
+
+		cl_uint lowSquared = (cl_uint)(lowThreshold * lowThreshold);
+		cl_uint highSquared = (cl_uint)(highThreshold * highThreshold);
+
+		cl::Event blurBegin, blurEnd, blur, hysteresis, finalize;
+		cl_event event;
 
 		try {
-			cv::Mat src;
-			frame.copyTo(src);
+			cl::setKernelArg(cannyNmsKernel_, 4, sizeof(cl_uint), &lowSquared);
+			cl::setKernelArg(cannyNmsKernel_, 5, sizeof(cl_uint), &highSquared);
+
+			// The queue is in-order and the last read blocks, so src only needs to stay valid until we return
+			for (int i = 0; i < layout.count(); ++i) {
+				TileLayout::Tile t = layout.tile(i);
+				cl_int4 core = tileCore(t);
+
+				enqueueTileInput(src, srcPitch, t, blurBegin, blurEnd);
+				cl::enqueueNDRangeKernel(commandQueue_, cannyBlurKernel_, 2, nullptr, globalWorkSize, localWorkSize, 0, nullptr, i == 0 ? &event : nullptr);
+				if (i == 0) {
+					blur = cl::Event(event);
+				}
+				cl::enqueueNDRangeKernel(commandQueue_, cannyGradientKernel_, 2, nullptr, globalWorkSize, localWorkSize);
+				cl::setKernelArg(cannyNmsKernel_, 6, sizeof(cl_int4), &core);
+				cl::enqueueNDRangeKernel(commandQueue_, cannyNmsKernel_, 2, nullptr, globalWorkSize, localWorkSize);
+				cl::countTransfer((size_t)layout.tileWidth * layout.tileHeight, 0);
+
+				if (layout.tiled()) {
+					enqueueReadEdges(t, dst, dstPitch);
+				}
+			}
+
+			if (!layout.tiled()) {
+				enqueueHysteresis(hysteresis);
+				cl::enqueueNDRangeKernel(commandQueue_, cannyFinalizeKernel_, 2, nullptr, globalWorkSize, localWorkSize, 0, nullptr, &event);
+				finalize = cl::Event(event);
+				enqueueReadCore(layout.tile(0), dst, dstPitch, true);
+			}
+			else {
+				// A sweep that promotes nothing leaves dst as it was, so the next one would too
+				bool changed = true;
+				while (changed) {
+					changed = false;
+					for (int i = 0; i < layout.count(); ++i) {
+						TileLayout::Tile t = layout.tile(i);
+
+						enqueueWriteEdges(t, dst, dstPitch);
+						if (enqueueHysteresis(hysteresis)) {
+							enqueueReadEdges(t, dst, dstPitch);
+							changed = true;
+						}
+					}
+				}
+
+				cl::finish(commandQueue_);
+				finalizeEdges(dst, dstPitch);
+			}
+		}
+		catch (const std::exception& e) {
+			// Nothing may still be writing into dst once we return
+			clFinish(commandQueue_);
+			throw std::runtime_error(e.what());
+		}
 
-			cl::enqueueWriteImage(commandQueue_, inputImage_, CL_TRUE, origin, region, 0, 0, src.data, 0, nullptr, &writeImage);
-			cl::enqueueNDRangeKernel(commandQueue_, sobelKernel_, 2, nullptr, globalWorkSize, localWorkSize, 1, &writeImage, &sobel);
-			cl::enqueueReadImage(commandQueue_, outputImage_, CL_TRUE, origin, region, 0, 0, src.data, 1, &sobel, &readImage);
-			cl::waitForEvents(1, &readImage);
+		return blurTime(blurBegin, blurEnd) + profile(blur, layout.tiled() ? hysteresis : finalize);
+	}
+
+	// Sobel edge statistics reduced on the device (sobel_stats in Sobel.cl).
+	// Writes STATS_SIZE counters into stats; only those bytes are read back,
+	// the edge image is never produced.
+	// Requires a program built from Sobel.cl. Returns the device time in milliseconds.
+	double edgeStats(const unsigned char* src, size_t srcPitch, int edgeThreshold, cl_uint* stats)
+	{
+		if (!statsReady_) {
+			initStats();
+		}
+
+		// Tiles only count their core, into the same counters
+		const TileLayout& layout = tiles_;
+		size_t tile = (size_t)cannyTile_;
+		size_t globalWorkSize[] = { ((size_t)layout.tileWidth + tile - 1) / tile * tile, ((size_t)layout.tileHeight + tile - 1) / tile * tile };
+		size_t localWorkSize[] = { tile, tile };
+
+		const cl_uint zero = 0;
+
+		cl::Event blurBegin, blurEnd, fill, read;
+		cl_event event;
+
+		try {
+			cl::setKernelArg(statsKernel_, 2, sizeof(int), &edgeThreshold);
 
-			timer.update(profile(sobel));
+			cl::enqueueFillBuffer(commandQueue_, statsBuffer_, &zero, sizeof(cl_uint), 0, STATS_SIZE * sizeof(cl_uint), 0, nullptr, &event);
+			fill = cl::Event(event);
+			for (int i = 0; i < layout.count(); ++i) {
+				TileLayout::Tile t = layout.tile(i);
+				cl_int4 core = tileCore(t);
+				cl_int4 frame = tileFrame(t);
 
-			src.copyTo(frame);
+				enqueueTileInput(src, srcPitch, t, blurBegin, blurEnd);
+				cl::setKernelArg(statsKernel_, 3, sizeof(cl_int4), &core);
+				cl::setKernelArg(statsKernel_, 4, sizeof(cl_int4), &frame);
+				cl::enqueueNDRangeKernel(commandQueue_, statsKernel_, 2, nullptr, globalWorkSize, localWorkSize);
+				cl::countTransfer((size_t)layout.tileWidth * layout.tileHeight, 0);
+			}
+			cl::enqueueReadBuffer(commandQueue_, statsBuffer_, CL_TRUE, 0, STATS_SIZE * sizeof(cl_uint), stats, 0, nullptr, &event);
+			read = cl::Event(event);
+			cl::countTransfer(0, STATS_SIZE * sizeof(cl_uint));
 		}
 		catch (const std::exception& e) {
 			throw std::runtime_error(e.what());
 		}
+
+		return blurTime(blurBegin, blurEnd) + profile(fill, read);
 	}
 
+	// Sobel on an interleaved 3-channel (BGR) frame (sobel_color in Sobel.cl). The L1
+	// magnitudes of the channels are folded by max, or by sum when sumChannels is set.
+	// Requires a program built from Sobel.cl. Returns the device time in milliseconds.
+	double filterColor(const unsigned char* src, size_t srcPitch, unsigned char* dst, size_t dstPitch, bool sumChannels)
+	{
+		if (!colorReady_) {
+			initColor();
+		}
+
+		const TileLayout& layout = tiles_;
+		size_t workSizeX = (((size_t)layout.tileWidth - 1) / preferredWorkgroupSize + 1) * preferredWorkgroupSize;
+		size_t globalWorkSize[] = { workSizeX, (size_t)layout.tileHeight };
+		size_t localWorkSize[] = { preferredWorkgroupSize, 1 };
+
+		const size_t rowBytes = (size_t)layout.tileWidth * 3;
+		size_t origin[] = { 0, 0, 0 };
+		size_t bufferRegion[] = { rowBytes, (size_t)layout.tileHeight, 1 };
+		const cl_int sum = sumChannels ? 1 : 0;
+
+		std::vector<cl::Event> kernels;
+		kernels.reserve(layout.count());
+		cl_event event;
+
+		try {
+			cl::setKernelArg(colorKernel_, 4, sizeof(cl_int), &sum);
+
+			// The queue is in-order and the last read blocks, so src only needs to stay valid until we return
+			for (int i = 0; i < layout.count(); ++i) {
+				TileLayout::Tile t = layout.tile(i);
+				const unsigned char* input = src + srcPitch * t.inputY + (size_t)t.inputX * 3;
+
+				cl::enqueueWriteBufferRect(commandQueue_, colorBuffer_, CL_FALSE, origin, origin, bufferRegion, rowBytes, 0, srcPitch, 0, input);
+				cl::enqueueNDRangeKernel(commandQueue_, colorKernel_, 2, nullptr, globalWorkSize, localWorkSize, 0, nullptr, &event);
+				kernels.push_back(cl::Event(event));
+				enqueueReadCore(t, dst, dstPitch, i + 1 == layout.count());
+				cl::countTransfer(bufferRegion[0] * bufferRegion[1], 0);
+			}
+		}
+		catch (const std::exception& e) {
+			clFinish(commandQueue_);
+			throw std::runtime_error(e.what());
+		}
+
+		double elapsed = 0.0;
+		for (const cl::Event& kernel : kernels) {
+			elapsed += profile(kernel);
+		}
+
+		return elapsed;
+	}
+
+	// Runs the Gaussian pre-filter of gaussian.h (Gaussian.cl at sourcePath) on every frame
+	// given to filter(), canny() and edgeStats(). The frame is uploaded into its own image
+	// and the last blur pass writes the filter input, so the blur adds no transfer.
+	// Call before the first frame. Not available for tiled frames.
+	void enableBlur(const std::string& sourcePath, const gaussian::BoxPlan& plan)
+	{
+		requireUntiled();
+
+		std::stringstream options;
+		options << "-D BOX_SEGMENT=" << BLUR_SEGMENT << " -D TRANSPOSE_TILE=" << cannyTile_;
+		blurProgram_ = initProgram(sourcePath, options.str());
+		initBlur(plan);
+	}
+
+	const TileLayout& tiles() const { return tiles_; }
+
+	// e.g. "Vivante OpenCL Device GC7000UL.6204 (GPU)"
+	const std::string& deviceName() const { return deviceName_; }
+
 private:
-	cl_platform_id findPlatform()
+	// filter() for frames beyond the device limits. Tiles alternate between two
+	// in-order queues, each owning one input/output image pair : while one tile
+	// runs, the next one uploads, and an image pair is only rewritten once its
+	// previous tile has been read back. Results are read straight into dst.
+	double filterTiles(const unsigned char* src, size_t srcPitch, unsigned char* dst, size_t dstPitch)
 	{
-		cl_uint numPlatforms = 0;
-		cl_platform_id platform;
+		const TileLayout& layout = tiles_;
+		cl_command_queue queues[] = { commandQueue_, tileQueue_ };
+		const cl::Mem* inputs[] = { &inputImage_, &tileInputImage_ };
+		const cl::Mem* outputs[] = { &outputImage_, &tileOutputImage_ };
+
+		size_t workSizeX = (((size_t)layout.tileWidth - 1) / preferredWorkgroupSize + 1) * preferredWorkgroupSize;
+		size_t globalWorkSize[] = { workSizeX, (size_t)layout.tileHeight };
+		size_t localWorkSize[] = { preferredWorkgroupSize, 1 };
+
+		size_t origin[] = { 0, 0, 0 };
+		size_t region[] = { (size_t)layout.tileWidth, (size_t)layout.tileHeight, 1 };
+
+		std::vector<cl::Event> kernels;
+		kernels.reserve(layout.count());
+		double elapsed = 0.0;
 
 		try {
-			cl::getPlatformIDs(0, nullptr, &numPlatforms);
-			if (numPlatforms < 1) {
-				throw std::runtime_error("There is no OpenCL platform.");
+			for (int i = 0; i < layout.count(); ++i) {
+				TileLayout::Tile tile = layout.tile(i);
+				int slot = i % 2;
+
+				// src and dst only need to stay valid until both queues are finished below
+				const unsigned char* input = src + srcPitch * tile.inputY + tile.inputX;
+				cl::enqueueWriteImage(queues[slot], *inputs[slot], CL_FALSE, origin, region, srcPitch, 0, input);
+
+				cl_event kernel;
+				cl::setKernelArg(filterKernel_, 0, *inputs[slot]);
+				cl::setKernelArg(filterKernel_, 1, *outputs[slot]);
+				cl::enqueueNDRangeKernel(queues[slot], filterKernel_, 2, nullptr, globalWorkSize, localWorkSize, 0, nullptr, &kernel);
+				kernels.push_back(cl::Event(kernel));
+
+				size_t coreOrigin[] = { (size_t)(tile.coreX - tile.inputX), (size_t)(tile.coreY - tile.inputY), 0 };
+				size_t coreRegion[] = { (size_t)tile.coreWidth, (size_t)tile.coreHeight, 1 };
+				unsigned char* output = dst + dstPitch * tile.coreY + tile.coreX;
+				cl::enqueueReadImage(queues[slot], *outputs[slot], CL_FALSE, coreOrigin, coreRegion, dstPitch, 0, output);
+				cl::countTransfer(region[0] * region[1], coreRegion[0] * coreRegion[1]);
 			}
-			cl::getPlatformIDs(1, &platform, nullptr);
+
+			cl::finish(commandQueue_);
+			cl::finish(tileQueue_);
 		}
 		catch (const std::exception& e) {
+			// Nothing may still be writing into dst once we return
+			clFinish(commandQueue_);
+			clFinish(tileQueue_);
 			throw std::runtime_error(e.what());
 		}
 
-		return platform;
+		for (const cl::Event& kernel : kernels) {
+			elapsed += profile(kernel);
+		}
+
+		return elapsed;
+	}
+
+	size_t frameSize() const
+	{
+		return (size_t)imgWidth_ * imgHeight_;
+	}
+
+	// Uploads src into inputImage_, through the pre-filter passes when enableBlur() was called.
+	// blurBegin and blurEnd receive the first and last pass, see blurTime().
+	void enqueueInput(const unsigned char* src, size_t srcPitch, cl::Event& blurBegin, cl::Event& blurEnd)
+	{
+		size_t origin[] = { 0, 0, 0 };
+		size_t region[] = { (size_t)imgWidth_, (size_t)imgHeight_, 1 };
+
+		if (!blurReady_) {
+			cl::enqueueWriteImage(commandQueue_, inputImage_, CL_FALSE, origin, region, srcPitch, 0, src);
+			return;
+		}
+
+		// One work-item per line element and segment, then the transpose between rows and columns
+		size_t tile = (size_t)cannyTile_;
+		size_t transposeWorkSize[] = { ((size_t)imgHeight_ + tile - 1) / tile * tile, ((size_t)imgWidth_ + tile - 1) / tile * tile };
+		size_t transposeLocalWorkSize[] = { tile, tile };
+		cl_event event;
+
+		cl::enqueueWriteImage(commandQueue_, blurSourceImage_, CL_FALSE, origin, region, srcPitch, 0, src);
+		for (int pass = 0; pass < BLUR_PASSES; ++pass) {
+			const BlurLines& lines = blurLines_[pass];
+			size_t workSize[] = { (size_t)lines.length, (size_t)((lines.end - lines.begin + BLUR_SEGMENT - 1) / BLUR_SEGMENT) };
+			bool timed = pass == 0 || pass == BLUR_PASSES - 1;
+			cl::enqueueNDRangeKernel(commandQueue_, blurKernels_[pass], 2, nullptr, workSize, nullptr, 0, nullptr, timed ? &event : nullptr);
+			if (pass == 0) {
+				blurBegin = cl::Event(event);
+			}
+			if (pass == BLUR_PASSES - 1) {
+				blurEnd = cl::Event(event);
+			}
+			if (pass == gaussian::PASSES - 1) {
+				cl::enqueueNDRangeKernel(commandQueue_, transposeKernel_, 2, nullptr, transposeWorkSize, transposeLocalWorkSize);
+			}
+		}
+	}
+
+	// Uploads the window of t into inputImage_. Untiled frames go through enqueueInput()
+	// and with it the pre-filter, tiled ones are blurred on the host.
+	void enqueueTileInput(const unsigned char* src, size_t srcPitch, const TileLayout::Tile& t, cl::Event& blurBegin, cl::Event& blurEnd)
+	{
+		if (!tiles_.tiled()) {
+			enqueueInput(src, srcPitch, blurBegin, blurEnd);
+			return;
+		}
+
+		size_t origin[] = { 0, 0, 0 };
+		size_t region[] = { (size_t)tiles_.tileWidth, (size_t)tiles_.tileHeight, 1 };
+		cl::enqueueWriteImage(commandQueue_, inputImage_, CL_FALSE, origin, region, srcPitch, 0, src + srcPitch * t.inputY + t.inputX);
+	}
+
+	// Reads the core of t from outputImage_ into its place in dst
+	void enqueueReadCore(const TileLayout::Tile& t, unsigned char* dst, size_t dstPitch, bool blocking)
+	{
+		size_t coreOrigin[] = { (size_t)(t.coreX - t.inputX), (size_t)(t.coreY - t.inputY), 0 };
+		size_t coreRegion[] = { (size_t)t.coreWidth, (size_t)t.coreHeight, 1 };
+		unsigned char* output = dst + dstPitch * t.coreY + t.coreX;
+		cl::enqueueReadImage(commandQueue_, outputImage_, blocking ? CL_TRUE : CL_FALSE, coreOrigin, coreRegion, dstPitch, 0, output);
+		cl::countTransfer(0, coreRegion[0] * coreRegion[1]);
+	}
+
+	// Runs canny_hysteresis over edgeBuffer_ until it is stable. Returns true if anything
+	// was promoted; last receives the last launch.
+	bool enqueueHysteresis(cl::Event& last)
+	{
+		size_t tile = (size_t)cannyTile_;
+		size_t globalWorkSize[] = { ((size_t)tiles_.tileWidth + tile - 1) / tile * tile, ((size_t)tiles_.tileHeight + tile - 1) / tile * tile };
+		size_t localWorkSize[] = { tile, tile };
+
+		const cl_int zero = 0;
+		cl_int changed = 0;
+		bool promoted = false;
+		cl_event event;
+
+		do {
+			cl::enqueueFillBuffer(commandQueue_, changedFlag_, &zero, sizeof(cl_int), 0, sizeof(cl_int));
+			cl::enqueueNDRangeKernel(commandQueue_, cannyHysteresisKernel_, 2, nullptr, globalWorkSize, localWorkSize, 0, nullptr, &event);
+			last = cl::Event(event);
+			cl::enqueueReadBuffer(commandQueue_, changedFlag_, CL_TRUE, 0, sizeof(cl_int), &changed);
+			cl::countTransfer(0, sizeof(cl_int));
+			promoted = promoted || changed != 0;
+		} while (changed != 0);
+
+		return promoted;
+	}
+
+	// Tiled canny() keeps the edge states in dst between passes : the window of t goes up
+	// into edgeBuffer_, only its core comes back
+	void enqueueWriteEdges(const TileLayout::Tile& t, const unsigned char* dst, size_t dstPitch)
+	{
+		size_t bufferOrigin[] = { 0, 0, 0 };
+		size_t hostOrigin[] = { (size_t)t.inputX, (size_t)t.inputY, 0 };
+		size_t region[] = { (size_t)tiles_.tileWidth, (size_t)tiles_.tileHeight, 1 };
+		cl::enqueueWriteBufferRect(commandQueue_, edgeBuffer_, CL_FALSE, bufferOrigin, hostOrigin, region, region[0], 0, dstPitch, 0, dst);
+		cl::countTransfer(region[0] * region[1], 0);
+	}
+
+	void enqueueReadEdges(const TileLayout::Tile& t, unsigned char* dst, size_t dstPitch)
+	{
+		size_t bufferOrigin[] = { (size_t)(t.coreX - t.inputX), (size_t)(t.coreY - t.inputY), 0 };
+		size_t hostOrigin[] = { (size_t)t.coreX, (size_t)t.coreY, 0 };
+		size_t region[] = { (size_t)t.coreWidth, (size_t)t.coreHeight, 1 };
+		cl::enqueueReadBufferRect(commandQueue_, edgeBuffer_, CL_FALSE, bufferOrigin, hostOrigin, region, (size_t)tiles_.tileWidth, 0, dstPitch, 0, dst);
+		cl::countTransfer(0, region[0] * region[1]);
+	}
+
+	// The host side of canny_finalize for the states left in dst
+	void finalizeEdges(unsigned char* dst, size_t dstPitch)
+	{
+		for (int y = 0; y < imgHeight_; ++y) {
+			unsigned char* row = dst + dstPitch * y;
+			for (int x = 0; x < imgWidth_; ++x) {
+				row[x] = row[x] == CANNY_STRONG ? 255 : 0;
+			}
+		}
+	}
+
+	// Kernel arguments locating a tile : its core as (x0, y0, x1, y1) in the tile window,
+	// and the window origin in the frame with the frame size
+	cl_int4 tileCore(const TileLayout::Tile& t) const
+	{
+		cl_int4 core;
+		core.s[0] = t.coreX - t.inputX;
+		core.s[1] = t.coreY - t.inputY;
+		core.s[2] = core.s[0] + t.coreWidth;
+		core.s[3] = core.s[1] + t.coreHeight;
+		return core;
+	}
+
+	cl_int4 tileFrame(const TileLayout::Tile& t) const
+	{
+		cl_int4 frame;
+		frame.s[0] = t.inputX;
+		frame.s[1] = t.inputY;
+		frame.s[2] = imgWidth_;
+		frame.s[3] = imgHeight_;
+		return frame;
+	}
+
+	// Device time of the pre-filter passes, 0 without pre-filter
+	double blurTime(const cl::Event& blurBegin, const cl::Event& blurEnd)
+	{
+		return blurBegin.get() != nullptr ? profile(blurBegin, blurEnd) : 0.0;
+	}
+
+	void requireUntiled()
+	{
+		if (tiles_.tiled()) {
+			std::stringstream ss;
+			ss << imgWidth_ << "x" << imgHeight_ << " exceeds the OpenCL device image limits, the device pre-filter does not run on tiles";
+			throw std::runtime_error(ss.str());
+		}
 	}
 
-	cl_device_id findDevice(const cl_platform_id& platform)
+	// The first GPU of any platform. Without one, the first CPU device (e.g. POCL),
+	// so that the OpenCL path still runs on machines without a GPU driver.
+	cl_device_id findDevice()
 	{
-		cl_uint numDevices = 0;
-		cl_device_id device;
+		cl_uint numPlatforms = 0;
+		std::vector<cl_platform_id> platforms;
 
 		try {
-			cl::getDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 0, nullptr, &numDevices);
-			if (numDevices < 1) {
-				throw std::runtime_error("There is no OpenCL device.");
+			cl::getPlatformIDs(0, nullptr, &numPlatforms);
+			if (numPlatforms < 1) {
+				throw std::runtime_error("There is no OpenCL platform.");
 			}
-			cl::getDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, nullptr);
+			platforms.resize(numPlatforms);
+			cl::getPlatformIDs(numPlatforms, &platforms[0], nullptr);
 		}
 		catch (const std::exception& e) {
 			throw std::runtime_error(e.what());
 		}
 
-		return device;
+		const cl_device_type types[] = { CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_CPU };
+		for (cl_device_type type : types) {
+			for (cl_platform_id platform : platforms) {
+				// A platform without such a device returns CL_DEVICE_NOT_FOUND
+				cl_device_id device;
+				cl_uint numDevices = 0;
+				if (clGetDeviceIDs(platform, type, 1, &device, &numDevices) == CL_SUCCESS && numDevices > 0) {
+					return device;
+				}
+			}
+		}
+
+		throw std::runtime_error("There is no OpenCL GPU or CPU device.");
 	}
 
 	std::string readFile(const std::string& fileName)
@@ -140,13 +658,47 @@ private:
 		return src;
 	}
 
-	cl_program initProgram(const std::string& filePath)
+	cl::Program initProgram(const std::string& filePath, const std::string& options)
 	{
-		cl_program program = 0;
+		cl::Program program;
 		try {
 			std::string src = readFile(filePath);
-			program = cl::createProgramWithSingleSource(context_, src);
-			cl::buildProgram(program, 1, &device_, nullptr, nullptr, nullptr);
+			program = cl::Program(cl::createProgramWithSingleSource(context_, src));
+			cl::buildProgram(program, 1, &device_, options.c_str(), nullptr, nullptr);
+		}
+		catch (const std::exception& e) {
+			throw std::runtime_error(e.what());
+		}
+
+		return program;
+	}
+
+	// Builds the program with the largest square tile (16, 8 or 4) that the tile-local kernels
+	// (canny_hysteresis, sobel_stats) can run with. They use local memory and barriers, so their
+	// limit is CL_KERNEL_WORK_GROUP_SIZE of the built kernel, which can be well below
+	// CL_DEVICE_MAX_WORK_GROUP_SIZE (e.g. on Vivante GPUs). Sources without them build once.
+	cl::Program initTileProgram(const std::string& sourcePath, const std::string& buildOptions)
+	{
+		const int tileSizes[] = { 16, 8, 4 };
+		size_t maxWorkgroupSize = 0;
+		cl::Program program;
+
+		try {
+			cl::getDeviceInfo(device_, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkgroupSize);
+
+			for (int tile : tileSizes) {
+				if ((size_t)(tile * tile) > maxWorkgroupSize && tile != tileSizes[2]) {
+					continue;
+				}
+
+				std::stringstream options;
+				options << buildOptions << " -D CANNY_TILE=" << tile << " -D STATS_TILE=" << tile << " -D STATS_GRID=" << STATS_GRID;
+				program = initProgram(sourcePath, options.str());
+				cannyTile_ = tile;
+				if (kernelFitsTile(program, "canny_hysteresis", tile) && kernelFitsTile(program, "sobel_stats", tile)) {
+					break;
+				}
+			}
 		}
 		catch (const std::exception& e) {
 			throw std::runtime_error(e.what());
@@ -155,12 +707,27 @@ private:
 		return program;
 	}
 
-	void initKernel()
+	// False only if the program has the kernel and it can not run tile x tile work-groups
+	bool kernelFitsTile(cl_program program, const char* kernelName, int tile)
+	{
+		cl_int errCode = CL_SUCCESS;
+		cl::Kernel kernel(clCreateKernel(program, kernelName, &errCode));
+		if (errCode != CL_SUCCESS) {
+			return true;
+		}
+
+		size_t workGroupSize = 0;
+		cl::getKernelWorkGroupInfo(kernel, device_, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &workGroupSize);
+
+		return workGroupSize >= (size_t)(tile * tile);
+	}
+
+	void initKernel(const std::string& kernelName)
 	{
 		try {
-			sobelKernel_ = cl::createKernel(sobelProgram_, "sobel");
-			cl::setKernelArg(sobelKernel_, 0, sizeof(cl_mem), &inputImage_);
-			cl::setKernelArg(sobelKernel_, 1, sizeof(cl_mem), &outputImage_);
+			filterKernel_ = cl::Kernel(cl::createKernel(program_, kernelName.c_str()));
+			cl::setKernelArg(filterKernel_, 0, inputImage_);
+			cl::setKernelArg(filterKernel_, 1, outputImage_);
 		}
 		catch (const std::exception& e) {
 			throw std::runtime_error(e.what());
@@ -173,6 +740,131 @@ private:
 		format.image_channel_order = CL_R;
 		format.image_channel_data_type = CL_UNSIGNED_INT8;
 
+		cl_image_desc image_desc;
+		// Tiled frames get two image pairs of the tile size, see filterTiles()
+		image_desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+		image_desc.image_width = tiles_.tileWidth;
+		image_desc.image_height = tiles_.tileHeight;
+		image_desc.image_array_size = 1;
+		image_desc.image_row_pitch = 0;
+		image_desc.image_slice_pitch = 0;
+		image_desc.num_mip_levels = 0;
+		image_desc.num_samples = 0;
+		image_desc.buffer = NULL;
+
+		try {
+			inputImage_ = cl::Mem(cl::createImage(context_, CL_MEM_READ_ONLY, &format, &image_desc, nullptr));
+			outputImage_ = cl::Mem(cl::createImage(context_, CL_MEM_WRITE_ONLY, &format, &image_desc, nullptr));
+
+			if (tiles_.tiled()) {
+				tileQueue_ = cl::CommandQueue(clCreateCommandQueue(context_, device_, CL_QUEUE_PROFILING_ENABLE, NULL));
+				tileInputImage_ = cl::Mem(cl::createImage(context_, CL_MEM_READ_ONLY, &format, &image_desc, nullptr));
+				tileOutputImage_ = cl::Mem(cl::createImage(context_, CL_MEM_WRITE_ONLY, &format, &image_desc, nullptr));
+			}
+		}
+		catch (const std::exception& e) {
+			throw std::runtime_error(e.what());
+		}
+	}
+
+	void initCanny()
+	{
+		cl_image_format format;
+		format.image_channel_order = CL_R;
+		format.image_channel_data_type = CL_UNSIGNED_INT8;
+
+		cl_image_desc image_desc;
+		// Every buffer holds one tile window, see canny()
+		image_desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+		image_desc.image_width = tiles_.tileWidth;
+		image_desc.image_height = tiles_.tileHeight;
+		image_desc.image_array_size = 1;
+		image_desc.image_row_pitch = 0;
+		image_desc.image_slice_pitch = 0;
+		image_desc.num_mip_levels = 0;
+		image_desc.num_samples = 0;
+		image_desc.buffer = NULL;
+
+		size_t tilePixels = (size_t)tiles_.tileWidth * tiles_.tileHeight;
+
+		try {
+			blurredImage_ = cl::Mem(cl::createImage(context_, CL_MEM_READ_WRITE, &format, &image_desc, nullptr));
+			gradientBuffer_ = cl::Mem(cl::createBuffer(context_, CL_MEM_READ_WRITE, tilePixels * sizeof(cl_uint), nullptr));
+			edgeBuffer_ = cl::Mem(cl::createBuffer(context_, CL_MEM_READ_WRITE, tilePixels, nullptr));
+			changedFlag_ = cl::Mem(cl::createBuffer(context_, CL_MEM_READ_WRITE, sizeof(cl_int), nullptr));
+
+			cannyBlurKernel_ = cl::Kernel(cl::createKernel(program_, "canny_blur"));
+			cl::setKernelArg(cannyBlurKernel_, 0, inputImage_);
+			cl::setKernelArg(cannyBlurKernel_, 1, blurredImage_);
+
+			cannyGradientKernel_ = cl::Kernel(cl::createKernel(program_, "canny_gradient"));
+			cl::setKernelArg(cannyGradientKernel_, 0, blurredImage_);
+			cl::setKernelArg(cannyGradientKernel_, 1, gradientBuffer_);
+
+			cannyNmsKernel_ = cl::Kernel(cl::createKernel(program_, "canny_nms"));
+			cl::setKernelArg(cannyNmsKernel_, 0, gradientBuffer_);
+			cl::setKernelArg(cannyNmsKernel_, 1, edgeBuffer_);
+			cl::setKernelArg(cannyNmsKernel_, 2, sizeof(int), &tiles_.tileWidth);
+			cl::setKernelArg(cannyNmsKernel_, 3, sizeof(int), &tiles_.tileHeight);
+
+			cannyHysteresisKernel_ = cl::Kernel(cl::createKernel(program_, "canny_hysteresis"));
+			cl::setKernelArg(cannyHysteresisKernel_, 0, edgeBuffer_);
+			cl::setKernelArg(cannyHysteresisKernel_, 1, sizeof(int), &tiles_.tileWidth);
+			cl::setKernelArg(cannyHysteresisKernel_, 2, sizeof(int), &tiles_.tileHeight);
+			cl::setKernelArg(cannyHysteresisKernel_, 3, changedFlag_);
+
+			cannyFinalizeKernel_ = cl::Kernel(cl::createKernel(program_, "canny_finalize"));
+			cl::setKernelArg(cannyFinalizeKernel_, 0, edgeBuffer_);
+			cl::setKernelArg(cannyFinalizeKernel_, 1, outputImage_);
+		}
+		catch (const std::exception& e) {
+			throw std::runtime_error(e.what());
+		}
+
+		cannyReady_ = true;
+	}
+
+	void initStats()
+	{
+		try {
+			statsBuffer_ = cl::Mem(cl::createBuffer(context_, CL_MEM_READ_WRITE, STATS_SIZE * sizeof(cl_uint), nullptr));
+
+			statsKernel_ = cl::Kernel(cl::createKernel(program_, "sobel_stats"));
+			cl::setKernelArg(statsKernel_, 0, inputImage_);
+			cl::setKernelArg(statsKernel_, 1, statsBuffer_);
+		}
+		catch (const std::exception& e) {
+			throw std::runtime_error(e.what());
+		}
+
+		statsReady_ = true;
+	}
+
+	void initColor()
+	{
+		try {
+			// One tile window
+			colorBuffer_ = cl::Mem(cl::createBuffer(context_, CL_MEM_READ_ONLY, (size_t)tiles_.tileWidth * tiles_.tileHeight * 3, nullptr));
+
+			colorKernel_ = cl::Kernel(cl::createKernel(program_, "sobel_color"));
+			cl::setKernelArg(colorKernel_, 0, colorBuffer_);
+			cl::setKernelArg(colorKernel_, 1, outputImage_);
+			cl::setKernelArg(colorKernel_, 2, sizeof(int), &tiles_.tileWidth);
+			cl::setKernelArg(colorKernel_, 3, sizeof(int), &tiles_.tileHeight);
+		}
+		catch (const std::exception& e) {
+			throw std::runtime_error(e.what());
+		}
+
+		colorReady_ = true;
+	}
+
+	void initBlur(const gaussian::BoxPlan& plan)
+	{
+		cl_image_format format;
+		format.image_channel_order = CL_R;
+		format.image_channel_data_type = CL_UNSIGNED_INT8;
+
 		cl_image_desc image_desc;
 		image_desc.image_type = CL_MEM_OBJECT_IMAGE2D;
 		image_desc.image_width = imgWidth_;
@@ -184,16 +876,85 @@ private:
 		image_desc.num_samples = 0;
 		image_desc.buffer = NULL;
 
+		// Like gaussian::BoxBlur, every pass but the last also covers an apron of lines beyond
+		// the frame. The row passes run on the transposed frame : their lines are the columns.
+		const int width = imgWidth_;
+		const int height = imgHeight_;
+		const int apron = gaussian::apron(plan);
+		const BlurLines lines[BLUR_PASSES] = {
+			{ height, 0, width - 1, -apron, width + apron },
+			{ height, 0, width + 2 * apron - 1, 0, width + 2 * apron },
+			{ height, 0, width + 2 * apron - 1, apron, apron + width },
+			{ width, apron, apron + height - 1, 0, height + 2 * apron },
+			{ width, 0, height + 2 * apron - 1, 0, height + 2 * apron },
+			{ width, 0, height + 2 * apron - 1, apron, apron + height },
+		};
+		// The last row pass holds the frame columns only, the first column pass finds them apron rows down
+		const int transposeWidth = height;
+		const int transposeHeight = width;
+		const int transposeOffset = apron * width;
+
+		size_t bufferSize = std::max((size_t)(width + 2 * apron) * height, (size_t)width * (height + 2 * apron)) * sizeof(cl_ushort);
+		const char* kernelNames[BLUR_PASSES] = { "box_rows_first", "box_columns", "box_columns", "box_columns", "box_columns", "box_columns_store" };
+
 		try {
-			inputImage_ = cl::createImage(context_, CL_MEM_READ_ONLY, &format, &image_desc, nullptr);
-			outputImage_ = cl::createImage(context_, CL_MEM_WRITE_ONLY, &format, &image_desc, nullptr);
+			// The last pass writes the filter input, which has to become writable
+			blurSourceImage_ = cl::Mem(cl::createImage(context_, CL_MEM_READ_ONLY, &format, &image_desc, nullptr));
+			inputImage_ = cl::Mem(cl::createImage(context_, CL_MEM_READ_WRITE, &format, &image_desc, nullptr));
+			cl::setKernelArg(filterKernel_, 0, inputImage_);
+
+			blurBuffers_[0] = cl::Mem(cl::createBuffer(context_, CL_MEM_READ_WRITE, bufferSize, nullptr));
+			blurBuffers_[1] = cl::Mem(cl::createBuffer(context_, CL_MEM_READ_WRITE, bufferSize, nullptr));
+
+			// Passes alternate between the two buffers, from the uploaded frame to the filter input :
+			// rows A, B, A, transposed into B, then columns A, B and the filter input
+			const cl::Mem* sources[BLUR_PASSES] = { &blurSourceImage_, &blurBuffers_[0], &blurBuffers_[1], &blurBuffers_[1], &blurBuffers_[0], &blurBuffers_[1] };
+			const cl::Mem* targets[BLUR_PASSES] = { &blurBuffers_[0], &blurBuffers_[1], &blurBuffers_[0], &blurBuffers_[0], &blurBuffers_[1], &inputImage_ };
+
+			for (int pass = 0; pass < BLUR_PASSES; ++pass) {
+				cl::Kernel& kernel = blurKernels_[pass];
+				const BlurLines& passLines = blurLines_[pass] = lines[pass];
+				float scale = gaussian::passScale(plan, pass);
+
+				kernel = cl::Kernel(cl::createKernel(blurProgram_, kernelNames[pass]));
+				cl::setKernelArg(kernel, 0, *sources[pass]);
+				cl::setKernelArg(kernel, 1, *targets[pass]);
+				cl::setKernelArg(kernel, 2, sizeof(int), &passLines.length);
+				cl::setKernelArg(kernel, 3, sizeof(int), &passLines.first);
+				cl::setKernelArg(kernel, 4, sizeof(int), &passLines.last);
+				cl::setKernelArg(kernel, 5, sizeof(int), &passLines.begin);
+				cl::setKernelArg(kernel, 6, sizeof(int), &passLines.end);
+				cl::setKernelArg(kernel, 7, sizeof(int), &plan.radius);
+				cl::setKernelArg(kernel, 8, sizeof(float), &plan.alpha);
+				cl::setKernelArg(kernel, 9, sizeof(float), &scale);
+			}
+
+			transposeKernel_ = cl::Kernel(cl::createKernel(blurProgram_, "transpose"));
+			cl::setKernelArg(transposeKernel_, 0, blurBuffers_[0]);
+			cl::setKernelArg(transposeKernel_, 1, blurBuffers_[1]);
+			cl::setKernelArg(transposeKernel_, 2, sizeof(int), &transposeWidth);
+			cl::setKernelArg(transposeKernel_, 3, sizeof(int), &transposeHeight);
+			cl::setKernelArg(transposeKernel_, 4, sizeof(int), &transposeOffset);
 		}
 		catch (const std::exception& e) {
 			throw std::runtime_error(e.what());
 		}
+
+		blurReady_ = true;
+	}
+
+	double profile(cl_event begin, cl_event end)
+	{
+		cl_ulong startTime = 0;
+		cl_ulong endTime = 0;
+
+		clGetEventProfilingInfo(begin, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &startTime, nullptr);
+		clGetEventProfilingInfo(end, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &endTime, nullptr);
+
+		return (double)(endTime - startTime) * 1.0e-6;
 	}
 
-	double profile(cl_event& ev)
+	double profile(cl_event ev)
 	{
 		cl_ulong startTime = 0;
 		cl_ulong endTime = 0;
@@ -205,14 +966,65 @@ private:
 	}
 
 private:
-	cl_context context_;
+	// Declared in dependency order, so that members are released before their context
 	cl_device_id device_;
-	cl_command_queue commandQueue_;
-	cl_program sobelProgram_;
-	cl_kernel sobelKernel_;
-	cl_mem inputImage_;
-	cl_mem outputImage_;
+	cl::Context context_;
+	cl::CommandQueue commandQueue_;
+	cl::Program program_;
+	cl::Kernel filterKernel_;
+	cl::Mem inputImage_;
+	cl::Mem outputImage_;
+
+	// Second queue and image pair for tiled frames
+	TileLayout tiles_;
+	cl::CommandQueue tileQueue_;
+	cl::Mem tileInputImage_;
+	cl::Mem tileOutputImage_;
+
+	// Canny resources, created on first use
+	bool cannyReady_ = false;
+	int cannyTile_ = 16;
+	cl::Kernel cannyBlurKernel_;
+	cl::Kernel cannyGradientKernel_;
+	cl::Kernel cannyNmsKernel_;
+	cl::Kernel cannyHysteresisKernel_;
+	cl::Kernel cannyFinalizeKernel_;
+	cl::Mem blurredImage_;
+	cl::Mem gradientBuffer_;
+	cl::Mem edgeBuffer_;
+	cl::Mem changedFlag_;
+
+	// Edge statistics resources, created on first use
+	bool statsReady_ = false;
+	cl::Kernel statsKernel_;
+	cl::Mem statsBuffer_;
+
+	// Colour Sobel resources, created on first use
+	bool colorReady_ = false;
+	cl::Kernel colorKernel_;
+	cl::Mem colorBuffer_;
+
+	// Gaussian pre-filter resources, see enableBlur()
+	static constexpr int BLUR_PASSES = 2 * gaussian::PASSES;
+	static constexpr int BLUR_SEGMENT = 64;		// line elements per work-item, see Gaussian.cl
+
+	// Lines of one blur pass, the arguments of the box kernels in Gaussian.cl
+	struct BlurLines
+	{
+		int length;			// elements per line, one work-item each
+		int first, last;	// input lines, replicated beyond them
+		int begin, end;		// output lines
+	};
+
+	bool blurReady_ = false;
+	cl::Program blurProgram_;
+	cl::Kernel blurKernels_[BLUR_PASSES];
+	BlurLines blurLines_[BLUR_PASSES];
+	cl::Kernel transposeKernel_;
+	cl::Mem blurSourceImage_;
+	cl::Mem blurBuffers_[2];
 
+	std::string deviceName_;
 	size_t preferredWorkgroupSize;
 	int imgWidth_;
 	int imgHeight_;
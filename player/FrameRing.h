@@ -0,0 +1,382 @@
+#pragma once
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+// Single-producer / multi-consumer frame ring in POSIX shared memory.
+//
+// The producer owns the segment and never waits for anyone: frame n goes into
+// slot n % slotCount, guarded by a per-slot sequence number (odd while the slot
+// is being written). Consumers map the segment read-only, read pixels in place
+// and validate the sequence afterwards. A consumer that falls a full ring behind
+// is moved to the newest frame and the gap is reported as dropped frames.
+//
+// Consumer usage:
+//   FrameRingConsumer ring("/vivante");
+//   FrameView frame;
+//   while (ring.next(frame, 1000) != FrameRingConsumer::Status::Closed) {
+//       ... use frame.data ...
+//       if (!ring.stillValid(frame)) { discard what was computed from it }
+//   }
+
+namespace framering
+{
+	constexpr uint32_t MAGIC = 0x47525656;	// "VVRG"
+	constexpr uint32_t VERSION = 1;
+	constexpr size_t ALIGNMENT = 64;
+
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Shared memory sequencing needs lock-free 64-bit atomics");
+	static_assert(ATOMIC_INT_LOCK_FREE == 2, "Shared memory sequencing needs lock-free 32-bit atomics");
+
+	inline size_t alignUp(size_t value)
+	{
+		return (value + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	}
+
+	inline uint64_t monotonicNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+	}
+
+	inline long futex(const std::atomic<uint32_t>* address, int op, uint32_t value, const struct timespec* timeout)
+	{
+		// Shared (non-private) futex, so it works across processes
+		return syscall(SYS_futex, const_cast<uint32_t*>(reinterpret_cast<const uint32_t*>(address)), op, value, timeout, nullptr, 0);
+	}
+}
+
+// Per-frame metadata, written by the producer next to the pixels
+struct FrameMeta
+{
+	uint64_t index;			// frame number since the producer started
+	uint64_t timestampNs;	// CLOCK_MONOTONIC when the frame was published
+	int32_t backend;		// vivante::Backend
+	int32_t op;				// vivante::Operator
+	double filterTime_ms;	// time spent in the filter
+	char backendName[16];
+};
+
+struct FrameView
+{
+	const unsigned char* data;
+	int width;
+	int height;
+	size_t stride;
+	FrameMeta meta;
+	uint64_t sequence;	// internal, checked by stillValid()
+};
+
+struct FrameRingHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t slotCount;
+	uint64_t slotSize;
+	uint64_t dataOffset;
+	std::atomic<uint64_t> published;	// number of frames published so far
+	std::atomic<uint32_t> wakeup;		// futex word, bumped on every publish and on close
+	std::atomic<uint32_t> closed;
+};
+
+struct FrameRingSlot
+{
+	std::atomic<uint64_t> sequence;		// 2 * index + 1 while writing, 2 * index + 2 once published
+	FrameMeta meta;
+};
+
+class FrameRingProducer
+{
+public:
+	FrameRingProducer() = delete;
+	FrameRingProducer(const std::string& name, int width, int height, int slotCount = 8) :
+		name_(name)
+	{
+		if (width < 1 || height < 1 || slotCount < 2) {
+			throw std::invalid_argument("Frame ring needs a positive size and at least 2 slots");
+		}
+
+		size_t stride = (size_t)width;
+		size_t slotSize = framering::alignUp(sizeof(FrameRingSlot)) + framering::alignUp(stride * height);
+		size_t dataOffset = framering::alignUp(sizeof(FrameRingHeader));
+		size_ = dataOffset + slotSize * slotCount;
+
+		// A fresh object every time : consumers still attached to a previous run
+		// keep their mapping instead of seeing it truncated under them
+		shm_unlink(name.c_str());
+		int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+		if (fd < 0) {
+			throw std::runtime_error("shm_open " + name + ": " + strerror(errno));
+		}
+		if (ftruncate(fd, (off_t)size_) != 0) {
+			int err = errno;
+			close(fd);
+			shm_unlink(name.c_str());
+			throw std::runtime_error("ftruncate " + name + ": " + strerror(err));
+		}
+
+		void* base = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (base == MAP_FAILED) {
+			shm_unlink(name.c_str());
+			throw std::runtime_error("mmap " + name + ": " + strerror(errno));
+		}
+		base_ = (unsigned char*)base;
+
+		header_ = new (base_) FrameRingHeader();
+		header_->width = (uint32_t)width;
+		header_->height = (uint32_t)height;
+		header_->stride = (uint32_t)stride;
+		header_->slotCount = (uint32_t)slotCount;
+		header_->slotSize = slotSize;
+		header_->dataOffset = dataOffset;
+		header_->published.store(0, std::memory_order_relaxed);
+		header_->wakeup.store(0, std::memory_order_relaxed);
+		header_->closed.store(0, std::memory_order_relaxed);
+		for (int i = 0; i < slotCount; ++i) {
+			new (slot(i)) FrameRingSlot();
+			slot(i)->sequence.store(0, std::memory_order_relaxed);
+		}
+
+		// Consumers check the magic last, once everything else is in place
+		header_->version = framering::VERSION;
+		std::atomic_thread_fence(std::memory_order_release);
+		header_->magic = framering::MAGIC;
+	}
+
+	~FrameRingProducer()
+	{
+		header_->closed.store(1, std::memory_order_release);
+		wakeConsumers();
+
+		munmap(base_, size_);
+		shm_unlink(name_.c_str());
+	}
+
+	FrameRingProducer(const FrameRingProducer&) = delete;
+	FrameRingProducer& operator=(const FrameRingProducer&) = delete;
+
+	int width() const { return (int)header_->width; }
+	int height() const { return (int)header_->height; }
+	size_t stride() const { return header_->stride; }
+
+	// Returns the pixel buffer of the next frame. The caller renders into it
+	// directly and then calls publish(); no consumer is waited for.
+	unsigned char* beginFrame()
+	{
+		uint64_t index = header_->published.load(std::memory_order_relaxed);
+		FrameRingSlot* s = slot(index % header_->slotCount);
+
+		s->sequence.store(2 * index + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		return pixels(s);
+	}
+
+	void publish(FrameMeta meta)
+	{
+		uint64_t index = header_->published.load(std::memory_order_relaxed);
+		FrameRingSlot* s = slot(index % header_->slotCount);
+
+		meta.index = index;
+		meta.timestampNs = framering::monotonicNs();
+		s->meta = meta;
+
+		s->sequence.store(2 * index + 2, std::memory_order_release);
+		header_->published.store(index + 1, std::memory_order_release);
+		wakeConsumers();
+	}
+
+private:
+	FrameRingSlot* slot(uint64_t i) { return (FrameRingSlot*)(base_ + header_->dataOffset + i * header_->slotSize); }
+	unsigned char* pixels(FrameRingSlot* s) { return (unsigned char*)s + framering::alignUp(sizeof(FrameRingSlot)); }
+
+	void wakeConsumers()
+	{
+		header_->wakeup.fetch_add(1, std::memory_order_release);
+		framering::futex(&header_->wakeup, FUTEX_WAKE, INT_MAX, nullptr);
+	}
+
+	std::string name_;
+	unsigned char* base_ = nullptr;
+	size_t size_ = 0;
+	FrameRingHeader* header_ = nullptr;
+};
+
+class FrameRingConsumer
+{
+public:
+	enum class Status : int
+	{
+		Frame,
+		Timeout,
+		Closed
+	};
+
+	FrameRingConsumer() = delete;
+	// Attaches to an existing ring. Starts at the newest frame, so a late
+	// consumer does not count the producer's history as dropped.
+	explicit FrameRingConsumer(const std::string& name)
+	{
+		int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if (fd < 0) {
+			throw std::runtime_error("shm_open " + name + ": " + strerror(errno));
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FrameRingHeader)) {
+			close(fd);
+			throw std::runtime_error(name + " is not a frame ring");
+		}
+		size_ = (size_t)st.st_size;
+
+		void* base = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (base == MAP_FAILED) {
+			throw std::runtime_error("mmap " + name + ": " + strerror(errno));
+		}
+		base_ = (const unsigned char*)base;
+		header_ = (FrameRingHeader*)base_;
+
+		if (header_->magic != framering::MAGIC) {
+			munmap((void*)base_, size_);
+			throw std::runtime_error(name + " is not a frame ring, or is not initialized yet");
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (header_->version != framering::VERSION ||
+			header_->dataOffset + header_->slotSize * header_->slotCount > size_)
+		{
+			munmap((void*)base_, size_);
+			throw std::runtime_error(name + " has an incompatible layout");
+		}
+
+		uint64_t published = header_->published.load(std::memory_order_acquire);
+		next_ = published > 0 ? published - 1 : 0;
+	}
+
+	~FrameRingConsumer()
+	{
+		munmap((void*)base_, size_);
+	}
+
+	FrameRingConsumer(const FrameRingConsumer&) = delete;
+	FrameRingConsumer& operator=(const FrameRingConsumer&) = delete;
+
+	int width() const { return (int)header_->width; }
+	int height() const { return (int)header_->height; }
+	int slotCount() const { return (int)header_->slotCount; }
+
+	// Frames the producer overwrote before this consumer got to them
+	uint64_t droppedFrames() const { return dropped_; }
+
+	// Waits up to timeoutMs (negative: forever) for the next frame and returns
+	// a view of it inside shared memory.
+	Status next(FrameView& view, int timeoutMs)
+	{
+		uint64_t deadline = framering::monotonicNs() + (uint64_t)(timeoutMs < 0 ? 0 : timeoutMs) * 1000000ull;
+
+		while (true) {
+			uint32_t wakeup = header_->wakeup.load(std::memory_order_acquire);
+			uint64_t published = header_->published.load(std::memory_order_acquire);
+
+			if (next_ < published) {
+				// Fell a whole ring behind : the oldest frames are gone, jump to the newest
+				if (published - next_ >= header_->slotCount) {
+					skipTo(published - 1);
+				}
+				if (tryRead(view)) {
+					++next_;
+					return Status::Frame;
+				}
+
+				// Overwritten while we were looking at it
+				skipTo(header_->published.load(std::memory_order_acquire) - 1);
+				continue;
+			}
+
+			if (header_->closed.load(std::memory_order_acquire)) {
+				return Status::Closed;
+			}
+
+			struct timespec remaining;
+			struct timespec* timeout = nullptr;
+			if (timeoutMs >= 0) {
+				uint64_t now = framering::monotonicNs();
+				if (now >= deadline) {
+					return Status::Timeout;
+				}
+				remaining.tv_sec = (time_t)((deadline - now) / 1000000000ull);
+				remaining.tv_nsec = (long)((deadline - now) % 1000000000ull);
+				timeout = &remaining;
+			}
+			framering::futex(&header_->wakeup, FUTEX_WAIT, wakeup, timeout);
+		}
+	}
+
+	// True if the producer has not started overwriting the frame since next()
+	// returned it, i.e. everything read from view.data is consistent.
+	bool stillValid(const FrameView& view) const
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return slot(view.meta.index % header_->slotCount)->sequence.load(std::memory_order_relaxed) == view.sequence;
+	}
+
+private:
+	const FrameRingSlot* slot(uint64_t i) const { return (const FrameRingSlot*)(base_ + header_->dataOffset + i * header_->slotSize); }
+
+	void skipTo(uint64_t index)
+	{
+		if (index > next_) {
+			dropped_ += index - next_;
+			next_ = index;
+		}
+	}
+
+	bool tryRead(FrameView& view)
+	{
+		const FrameRingSlot* s = slot(next_ % header_->slotCount);
+		uint64_t expected = 2 * next_ + 2;
+
+		if (s->sequence.load(std::memory_order_acquire) != expected) {
+			return false;
+		}
+		view.meta = s->meta;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (s->sequence.load(std::memory_order_relaxed) != expected) {
+			return false;
+		}
+
+		view.data = (const unsigned char*)s + framering::alignUp(sizeof(FrameRingSlot));
+		view.width = (int)header_->width;
+		view.height = (int)header_->height;
+		view.stride = header_->stride;
+		view.sequence = expected;
+
+		return true;
+	}
+
+	const unsigned char* base_ = nullptr;
+	size_t size_ = 0;
+	const FrameRingHeader* header_ = nullptr;
+	uint64_t next_ = 0;
+	uint64_t dropped_ = 0;
+};
@@ -0,0 +1,137 @@
+// Constant-time Gaussian pre-filter, the device side of gaussian.h.
+//
+// Three extended box passes along the rows, then three down the columns. Each
+// work-item keeps a running sum over its segment of a line, so the cost per
+// pixel does not depend on the radius. Borders are replicated, intermediate
+// values are 8.8 fixed point and every pass uses the arithmetic of BoxBlur.
+//
+// Every pass walks down columns : work-item x steps through BOX_SEGMENT rows of
+// column x, so neighbouring work-items read and write neighbouring addresses on
+// every step, and each column is split over height / BOX_SEGMENT work-items.
+// The row passes run on the frame transposed (box_rows_first reads the image
+// along its rows and writes it transposed), transpose turns it back.
+//
+// A pass reads lines of length elements, lines first .. last of src being
+// replicated beyond them, and writes lines begin .. end - 1 from the first line
+// of dst on; work-item (i, segment) computes element i of its lines.
+//
+//   radius, alpha : gaussian::BoxPlan, the same for every pass
+//   scale         : gaussian::passScale of the pass
+
+#ifndef BOX_SEGMENT
+#define BOX_SEGMENT     64
+#endif
+
+#ifndef TRANSPOSE_TILE
+#define TRANSPOSE_TILE  16
+#endif
+
+__constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP_TO_EDGE |
+                               CLK_FILTER_NEAREST;
+
+inline float box_value(int sum, int ends, float alpha, float scale)
+{
+    return ((float)sum + alpha * (float)ends) * scale + 0.5f;
+}
+
+// Pass 0 : 8-bit frame to 8.8, lines are the image columns (length : image height)
+kernel void box_rows_first(__read_only image2d_t src, __global ushort* dst, int length, int first, int last, int begin, int end,
+                           int radius, float alpha, float scale)
+{
+    int y = get_global_id(0);
+    int x0 = begin + get_global_id(1) * BOX_SEGMENT;
+
+    if (y >= length || x0 >= end) {
+        return;
+    }
+
+    int sum = 0;
+    for (int i = x0 - radius; i <= x0 + radius; ++i) {
+        sum += (int)read_imageui(src, sampler, (int2)(clamp(i, first, last), y)).x;
+    }
+
+    int x1 = min(x0 + BOX_SEGMENT, end);
+    for (int x = x0; x < x1; ++x) {
+        int left = (int)read_imageui(src, sampler, (int2)(clamp(x - radius - 1, first, last), y)).x;
+        int right = (int)read_imageui(src, sampler, (int2)(clamp(x + radius + 1, first, last), y)).x;
+        dst[(x - begin) * length + y] = (ushort)(int)box_value(sum, left + right, alpha, scale);
+        sum += right - (int)read_imageui(src, sampler, (int2)(clamp(x - radius, first, last), y)).x;
+    }
+}
+
+// Passes 1 to 4 : rows of the transposed frame, then columns of the frame
+kernel void box_columns(__global const ushort* src, __global ushort* dst, int length, int first, int last, int begin, int end,
+                        int radius, float alpha, float scale)
+{
+    int x = get_global_id(0);
+    int y0 = begin + get_global_id(1) * BOX_SEGMENT;
+
+    if (x >= length || y0 >= end) {
+        return;
+    }
+
+    int sum = 0;
+    for (int i = y0 - radius; i <= y0 + radius; ++i) {
+        sum += src[clamp(i, first, last) * length + x];
+    }
+
+    int y1 = min(y0 + BOX_SEGMENT, end);
+    for (int y = y0; y < y1; ++y) {
+        int above = src[clamp(y - radius - 1, first, last) * length + x];
+        int below = src[clamp(y + radius + 1, first, last) * length + x];
+        dst[(y - begin) * length + x] = (ushort)(int)box_value(sum, above + below, alpha, scale);
+        sum += below - src[clamp(y - radius, first, last) * length + x];
+    }
+}
+
+// Pass 5 : 8.8 back to 8-bit, written into the image read by the edge kernels
+kernel void box_columns_store(__global const ushort* src, __write_only image2d_t dst, int length, int first, int last, int begin, int end,
+                              int radius, float alpha, float scale)
+{
+    int x = get_global_id(0);
+    int y0 = begin + get_global_id(1) * BOX_SEGMENT;
+
+    if (x >= length || y0 >= end) {
+        return;
+    }
+
+    int sum = 0;
+    for (int i = y0 - radius; i <= y0 + radius; ++i) {
+        sum += src[clamp(i, first, last) * length + x];
+    }
+
+    int y1 = min(y0 + BOX_SEGMENT, end);
+    for (int y = y0; y < y1; ++y) {
+        int above = src[clamp(y - radius - 1, first, last) * length + x];
+        int below = src[clamp(y + radius + 1, first, last) * length + x];
+        uint value = (uint)(int)box_value(sum, above + below, alpha, scale);
+        write_imageui(dst, (int2)(x, y - begin), (uint4)(min(value, (uint)255), 0, 0, 255));
+        sum += below - src[clamp(y - radius, first, last) * length + x];
+    }
+}
+
+// src has height lines of width, dst gets width lines of height from element offset on.
+// Each work-group moves one tile through local memory, so both sides stay coalesced.
+kernel __attribute__((reqd_work_group_size(TRANSPOSE_TILE, TRANSPOSE_TILE, 1)))
+void transpose(__global const ushort* src, __global ushort* dst, int width, int height, int offset)
+{
+    __local ushort tile[TRANSPOSE_TILE][TRANSPOSE_TILE + 1];
+
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if (x < width && y < height) {
+        tile[ly][lx] = src[y * width + x];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // lx now runs along a dst line, which is a src column
+    x = get_group_id(1) * TRANSPOSE_TILE + lx;
+    y = get_group_id(0) * TRANSPOSE_TILE + ly;
+    if (x < height && y < width) {
+        dst[offset + y * height + x] = tile[lx][ly];
+    }
+}
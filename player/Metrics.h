@@ -0,0 +1,547 @@
+#pragma once
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "vivante.h"
+
+// Player metrics for long-running instances.
+//
+// The frame loop only performs relaxed atomic increments : no lock, no allocation,
+// no system call. Everything else happens on the exporter thread, which serves the
+// Prometheus text format on 127.0.0.1:<port>/metrics and/or rewrites a JSON file
+// every few seconds. Counters are cumulative for the life of the process, a looping
+// video does not reset them.
+//
+//   curl -s localhost:9100/metrics
+
+enum class Stage : int
+{
+	Read,		// decoding / reading the input frame
+	Convert,	// BGR to grey (video mode)
+	Filter,		// Filter::process wall time, including OpenCL transfers
+	Publish,	// shared memory ring publish
+	Display,	// overlay and imshow (video mode)
+	Write,		// writing the output frame (stream mode)
+
+	Count
+};
+
+inline const char* stageName(Stage stage)
+{
+	switch (stage) {
+	case Stage::Read:		return "read";
+	case Stage::Convert:	return "convert";
+	case Stage::Filter:		return "filter";
+	case Stage::Publish:	return "publish";
+	case Stage::Display:	return "display";
+	case Stage::Write:		return "write";
+	case Stage::Count:		break;
+	}
+
+	return "";
+}
+
+// printf into out, however long the result
+inline void appendf(std::string& out, const char* format, ...)
+{
+	char field[256];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(field, sizeof(field), format, args);
+	va_end(args);
+
+	if (length < 0) {
+		return;
+	}
+	if ((size_t)length < sizeof(field)) {
+		out.append(field, length);
+		return;
+	}
+
+	size_t offset = out.size();
+	out.resize(offset + length + 1);
+	va_start(args, format);
+	vsnprintf(&out[offset], length + 1, format, args);
+	va_end(args);
+	out.resize(offset + length);
+}
+
+// Fixed-bucket latency histogram. Buckets are stored individually and made
+// cumulative on export, so observe() is a single fetch_add per field.
+class LatencyHistogram
+{
+public:
+	static constexpr int BUCKETS = 12;
+
+	// Upper bounds in seconds of all buckets but the last one (+Inf)
+	static const double* bounds()
+	{
+		static const double upper[BUCKETS - 1] = { 0.0005, 0.001, 0.002, 0.004, 0.008, 0.016, 0.033, 0.066, 0.133, 0.266, 0.5 };
+		return upper;
+	}
+
+	LatencyHistogram() : sumNs_(0)
+	{
+		for (int i = 0; i < BUCKETS; ++i) {
+			counts_[i] = 0;
+		}
+	}
+
+	void observe(double ms)
+	{
+		double seconds = ms * 1.0e-3;
+		int bucket = 0;
+		while (bucket < BUCKETS - 1 && seconds > bounds()[bucket]) {
+			++bucket;
+		}
+
+		counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+		sumNs_.fetch_add((uint64_t)(ms * 1.0e6), std::memory_order_relaxed);
+	}
+
+	// Per-bucket counts (not cumulative). Concurrent observations may land between
+	// the loads, which only skews the snapshot by the frames in flight.
+	uint64_t snapshot(uint64_t counts[BUCKETS], double& sumSeconds) const
+	{
+		uint64_t total = 0;
+		for (int i = 0; i < BUCKETS; ++i) {
+			counts[i] = counts_[i].load(std::memory_order_relaxed);
+			total += counts[i];
+		}
+		sumSeconds = sumNs_.load(std::memory_order_relaxed) * 1.0e-9;
+
+		return total;
+	}
+
+private:
+	std::atomic<uint64_t> counts_[BUCKETS];
+	std::atomic<uint64_t> sumNs_;
+};
+
+class Metrics
+{
+public:
+	// One slot per vivante::Backend value
+	static constexpr int BACKENDS = (int)vivante::Backend::Auto + 1;
+	static constexpr int STAGES = (int)Stage::Count;
+
+	Metrics() :
+		droppedFrames_(0),
+		inputFd_(-1),
+		outputFd_(-1),
+		frameBytes_(0),
+		start_(std::chrono::steady_clock::now())
+	{
+		for (int i = 0; i < BACKENDS; ++i) {
+			frames_[i] = 0;
+		}
+	}
+
+	// A frame processed by backend (the active one for Backend::Auto), with the
+	// filter time reported by the library
+	void frame(vivante::Backend backend, double filterTime_ms)
+	{
+		int index = (int)backend;
+		frames_[index].fetch_add(1, std::memory_order_relaxed);
+		filterLatency_[index].observe(filterTime_ms);
+	}
+
+	void stage(Stage stage, double ms)
+	{
+		stageLatency_[(int)stage].observe(ms);
+	}
+
+	// A frame that missed its display deadline
+	void dropped()
+	{
+		droppedFrames_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Pipes or sockets whose fill level is exported as a queue depth, -1 : none.
+	// frameBytes converts bytes into frames.
+	void watchQueues(int inputFd, int outputFd, size_t frameBytes)
+	{
+		frameBytes_ = frameBytes;
+		inputFd_ = isQueue(inputFd) ? inputFd : -1;
+		outputFd_ = isQueue(outputFd) ? outputFd : -1;
+	}
+
+	std::string prometheus() const
+	{
+		std::string out;
+		out += "# HELP vivante_frames_total Frames processed, by the backend that ran them\n";
+		out += "# TYPE vivante_frames_total counter\n";
+		for (int i = 0; i < BACKENDS; ++i) {
+			appendf(out, "vivante_frames_total{backend=\"%s\"} %llu\n",
+				vivante::backendName((vivante::Backend)i), (unsigned long long)frames_[i].load(std::memory_order_relaxed));
+		}
+
+		out += "# HELP vivante_dropped_frames_total Frames that missed their display deadline\n";
+		out += "# TYPE vivante_dropped_frames_total counter\n";
+		appendf(out, "vivante_dropped_frames_total %llu\n", (unsigned long long)droppedFrames_.load(std::memory_order_relaxed));
+
+		out += "# HELP vivante_filter_latency_seconds Filter time reported by the backend (OpenCL : device time)\n";
+		out += "# TYPE vivante_filter_latency_seconds histogram\n";
+		for (int i = 0; i < BACKENDS; ++i) {
+			std::string labels = std::string("backend=\"") + vivante::backendName((vivante::Backend)i) + "\"";
+			appendHistogram(out, "vivante_filter_latency_seconds", labels.c_str(), filterLatency_[i]);
+		}
+
+		out += "# HELP vivante_stage_latency_seconds Wall time of each step of the frame loop\n";
+		out += "# TYPE vivante_stage_latency_seconds histogram\n";
+		for (int i = 0; i < STAGES; ++i) {
+			std::string labels = std::string("stage=\"") + stageName((Stage)i) + "\"";
+			appendHistogram(out, "vivante_stage_latency_seconds", labels.c_str(), stageLatency_[i]);
+		}
+
+		double input = 0.0, output = 0.0;
+		if (queueDepths(input, output)) {
+			out += "# HELP vivante_queue_frames Frames waiting in the input and output pipes\n";
+			out += "# TYPE vivante_queue_frames gauge\n";
+			appendf(out, "vivante_queue_frames{queue=\"input\"} %.3f\nvivante_queue_frames{queue=\"output\"} %.3f\n", input, output);
+		}
+
+		vivante::ResourceUsage usage = vivante::resourceUsage();
+		out += "# HELP vivante_opencl_transfer_bytes_total Bytes copied between host and OpenCL device\n";
+		out += "# TYPE vivante_opencl_transfer_bytes_total counter\n";
+		appendf(out, "vivante_opencl_transfer_bytes_total{direction=\"upload\"} %llu\nvivante_opencl_transfer_bytes_total{direction=\"download\"} %llu\n",
+			(unsigned long long)usage.clBytesUploaded, (unsigned long long)usage.clBytesDownloaded);
+
+		out += "# HELP vivante_opencl_memory_bytes Live OpenCL buffers and images\n";
+		out += "# TYPE vivante_opencl_memory_bytes gauge\n";
+		appendf(out, "vivante_opencl_memory_bytes %lld\n", (long long)usage.clMemoryBytes);
+
+		out += "# HELP vivante_opencl_objects Live OpenCL objects of any type\n";
+		out += "# TYPE vivante_opencl_objects gauge\n";
+		appendf(out, "vivante_opencl_objects %ld\n", usage.clObjects);
+
+		out += "# HELP vivante_resident_memory_bytes Resident set size of the process\n";
+		out += "# TYPE vivante_resident_memory_bytes gauge\n";
+		appendf(out, "vivante_resident_memory_bytes %llu\n", (unsigned long long)residentBytes());
+
+		out += "# HELP vivante_uptime_seconds Time since the metrics started\n";
+		out += "# TYPE vivante_uptime_seconds gauge\n";
+		appendf(out, "vivante_uptime_seconds %.3f\n", uptime());
+
+		return out;
+	}
+
+	// Same content as one JSON object. Histograms hold per-bucket counts, the
+	// bucket upper bounds are listed once in "bucket_le_ms" (the last bucket is unbounded).
+	std::string json() const
+	{
+		std::string out;
+		appendf(out, "{\"uptime_s\":%.3f,\"bucket_le_ms\":[", uptime());
+		for (int i = 0; i < LatencyHistogram::BUCKETS - 1; ++i) {
+			appendf(out, "%s%g", i > 0 ? "," : "", LatencyHistogram::bounds()[i] * 1.0e3);
+		}
+
+		out += "],\"frames\":{";
+		for (int i = 0; i < BACKENDS; ++i) {
+			appendf(out, "%s\"%s\":%llu", i > 0 ? "," : "",
+				vivante::backendName((vivante::Backend)i), (unsigned long long)frames_[i].load(std::memory_order_relaxed));
+		}
+
+		appendf(out, "},\"dropped_frames\":%llu,\"filter_latency\":{", (unsigned long long)droppedFrames_.load(std::memory_order_relaxed));
+		for (int i = 0; i < BACKENDS; ++i) {
+			appendf(out, "%s\"%s\":", i > 0 ? "," : "", vivante::backendName((vivante::Backend)i));
+			appendJsonHistogram(out, filterLatency_[i]);
+		}
+
+		out += "},\"stage_latency\":{";
+		for (int i = 0; i < STAGES; ++i) {
+			appendf(out, "%s\"%s\":", i > 0 ? "," : "", stageName((Stage)i));
+			appendJsonHistogram(out, stageLatency_[i]);
+		}
+		out += "}";
+
+		double input = 0.0, output = 0.0;
+		if (queueDepths(input, output)) {
+			appendf(out, ",\"queue_frames\":{\"input\":%.3f,\"output\":%.3f}", input, output);
+		}
+
+		vivante::ResourceUsage usage = vivante::resourceUsage();
+		appendf(out, ",\"opencl\":{\"uploaded_bytes\":%llu,\"downloaded_bytes\":%llu,\"memory_bytes\":%lld,\"objects\":%ld}",
+			(unsigned long long)usage.clBytesUploaded, (unsigned long long)usage.clBytesDownloaded, (long long)usage.clMemoryBytes, usage.clObjects);
+
+		appendf(out, ",\"resident_memory_bytes\":%llu}\n", (unsigned long long)residentBytes());
+
+		return out;
+	}
+
+private:
+	static bool isQueue(int fd)
+	{
+		struct stat st;
+		return fd >= 0 && fstat(fd, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode));
+	}
+
+	static int queuedBytes(int fd)
+	{
+		int bytes = 0;
+		return ioctl(fd, FIONREAD, &bytes) == 0 ? bytes : 0;
+	}
+
+	bool queueDepths(double& input, double& output) const
+	{
+		if ((inputFd_ < 0 && outputFd_ < 0) || frameBytes_ == 0) {
+			return false;
+		}
+
+		input = inputFd_ >= 0 ? (double)queuedBytes(inputFd_) / frameBytes_ : 0.0;
+		output = outputFd_ >= 0 ? (double)queuedBytes(outputFd_) / frameBytes_ : 0.0;
+		return true;
+	}
+
+	static uint64_t residentBytes()
+	{
+		unsigned long long pages = 0, resident = 0;
+		FILE* statm = fopen("/proc/self/statm", "r");
+		if (statm == nullptr) {
+			return 0;
+		}
+		if (fscanf(statm, "%llu %llu", &pages, &resident) != 2) {
+			resident = 0;
+		}
+		fclose(statm);
+
+		return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+	}
+
+	double uptime() const
+	{
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+		return elapsed.count();
+	}
+
+	static void appendHistogram(std::string& out, const char* name, const char* labels, const LatencyHistogram& histogram)
+	{
+		uint64_t counts[LatencyHistogram::BUCKETS];
+		double sum = 0.0;
+		uint64_t total = histogram.snapshot(counts, sum);
+		uint64_t cumulative = 0;
+		for (int i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+			cumulative += counts[i];
+			if (i < LatencyHistogram::BUCKETS - 1) {
+				appendf(out, "%s_bucket{%s,le=\"%g\"} %llu\n", name, labels, LatencyHistogram::bounds()[i], (unsigned long long)cumulative);
+			}
+			else {
+				appendf(out, "%s_bucket{%s,le=\"+Inf\"} %llu\n", name, labels, (unsigned long long)cumulative);
+			}
+		}
+		appendf(out, "%s_sum{%s} %.6f\n%s_count{%s} %llu\n", name, labels, sum, name, labels, (unsigned long long)total);
+	}
+
+	static void appendJsonHistogram(std::string& out, const LatencyHistogram& histogram)
+	{
+		uint64_t counts[LatencyHistogram::BUCKETS];
+		double sum = 0.0;
+		uint64_t total = histogram.snapshot(counts, sum);
+		appendf(out, "{\"count\":%llu,\"sum_ms\":%.3f,\"buckets\":[", (unsigned long long)total, sum * 1.0e3);
+		for (int i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+			appendf(out, "%s%llu", i > 0 ? "," : "", (unsigned long long)counts[i]);
+		}
+		out += "]}";
+	}
+
+	std::atomic<uint64_t> frames_[BACKENDS];
+	std::atomic<uint64_t> droppedFrames_;
+	LatencyHistogram filterLatency_[BACKENDS];
+	LatencyHistogram stageLatency_[STAGES];
+
+	// Set before the exporter starts, read-only afterwards
+	int inputFd_;
+	int outputFd_;
+	size_t frameBytes_;
+	std::chrono::steady_clock::time_point start_;
+};
+
+// Times consecutive steps of the frame loop : lap() returns the milliseconds
+// since the previous lap (or construction).
+class StageClock
+{
+public:
+	StageClock() : last_(std::chrono::steady_clock::now()) {}
+
+	double lap()
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		std::chrono::duration<double, std::milli> elapsed = now - last_;
+		last_ = now;
+		return elapsed.count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point last_;
+};
+
+// Background thread exporting a Metrics instance. Throws std::runtime_error if the
+// port can not be bound, so that a misconfiguration shows up at startup.
+class MetricsExporter
+{
+public:
+	// port 0 : no HTTP endpoint, jsonPath null : no JSON file
+	MetricsExporter(const Metrics& metrics, int port, const char* jsonPath, int intervalSeconds = 10) :
+		metrics_(metrics),
+		listenFd_(-1),
+		jsonPath_(jsonPath ? jsonPath : ""),
+		interval_(intervalSeconds > 0 ? intervalSeconds : 10),
+		stop_(false)
+	{
+		if (port > 0) {
+			listen(port);
+		}
+		thread_ = std::thread(&MetricsExporter::run, this);
+	}
+
+	// Writes a last JSON dump, so that short runs are recorded as well
+	~MetricsExporter()
+	{
+		stop_ = true;
+		thread_.join();
+		if (listenFd_ >= 0) {
+			close(listenFd_);
+		}
+		dump();
+	}
+
+	MetricsExporter(const MetricsExporter&) = delete;
+	MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+private:
+	void listen(int port)
+	{
+		listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (listenFd_ < 0) {
+			throw std::runtime_error(std::string("Metrics : socket failed, ") + strerror(errno));
+		}
+
+		int reuse = 1;
+		setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+		// Local scraping only, the endpoint has no authentication
+		struct sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons((uint16_t)port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		if (bind(listenFd_, (struct sockaddr*)&address, sizeof(address)) != 0 || ::listen(listenFd_, 8) != 0) {
+			int error = errno;
+			close(listenFd_);
+			listenFd_ = -1;
+			throw std::runtime_error("Metrics : can not listen on 127.0.0.1:" + std::to_string(port) + ", " + strerror(error));
+		}
+	}
+
+	void run()
+	{
+		std::chrono::steady_clock::time_point nextDump = std::chrono::steady_clock::now() + std::chrono::seconds(interval_);
+
+		while (!stop_) {
+			// Short timeout, so that the destructor does not wait long for the thread
+			if (listenFd_ >= 0) {
+				struct pollfd fds = { listenFd_, POLLIN, 0 };
+				if (poll(&fds, 1, 200) > 0) {
+					int client = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+					if (client >= 0) {
+						serve(client);
+						close(client);
+					}
+				}
+			}
+			else {
+				std::this_thread::sleep_for(std::chrono::milliseconds(200));
+			}
+
+			if (std::chrono::steady_clock::now() >= nextDump) {
+				dump();
+				nextDump += std::chrono::seconds(interval_);
+			}
+		}
+	}
+
+	// One request per connection, HTTP/1.0 style
+	void serve(int client)
+	{
+		struct timeval timeout = { 1, 0 };
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		char request[1024];
+		ssize_t n = recv(client, request, sizeof(request) - 1, 0);
+		if (n <= 0) {
+			return;
+		}
+		request[n] = '\0';
+
+		std::string body;
+		const char* status = "200 OK";
+		if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0) {
+			body = metrics_.prometheus();
+		}
+		else {
+			status = "404 Not Found";
+			body = "Not found, try /metrics\n";
+		}
+
+		std::string response = std::string("HTTP/1.0 ") + status + "\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: " + std::to_string(body.size()) + "\r\n"
+			"Connection: close\r\n\r\n" + body;
+
+		size_t done = 0;
+		while (done < response.size()) {
+			ssize_t sent = send(client, response.c_str() + done, response.size() - done, MSG_NOSIGNAL);
+			if (sent <= 0) {
+				return;
+			}
+			done += (size_t)sent;
+		}
+	}
+
+	// Written to a temporary file and renamed, readers never see a partial dump
+	void dump()
+	{
+		if (jsonPath_.empty()) {
+			return;
+		}
+
+		std::string temporary = jsonPath_ + ".tmp";
+		FILE* file = fopen(temporary.c_str(), "w");
+		if (file == nullptr) {
+			return;
+		}
+
+		std::string content = metrics_.json();
+		bool written = fwrite(content.c_str(), 1, content.size(), file) == content.size();
+		written = fclose(file) == 0 && written;
+		if (written) {
+			rename(temporary.c_str(), jsonPath_.c_str());
+		}
+	}
+
+	const Metrics& metrics_;
+	int listenFd_;
+	std::string jsonPath_;
+	int interval_;
+	std::atomic<bool> stop_;
+	std::thread thread_;
+};
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Raw video over file descriptors, for running between other processes
+// (e.g. ffmpeg -f rawvideo -pix_fmt gray - | player --stream ... | consumer).
+//
+// Frames are read straight into buffers allocated once per stream and written
+// back with a single writev() per frame, so the hot path neither allocates nor
+// copies. Chroma planes are consumed and replaced by neutral grey, since the
+// output is an edge map.
+
+enum class StreamFormat : int
+{
+	Gray,		// rawvideo, pix_fmt gray
+	YUV420P,	// rawvideo, pix_fmt yuv420p
+	Y4M			// YUV4MPEG2 with 8-bit mono, 420, 422 or 444 chroma
+};
+
+struct StreamInfo
+{
+	StreamFormat format;
+	int width;
+	int height;
+	size_t chromaSize;		// bytes of chroma following the luma plane in every frame
+	std::string y4mHeader;	// stream header without the trailing newline, Y4M only
+
+	size_t lumaSize() const { return (size_t)width * height; }
+};
+
+namespace rawstream
+{
+	// Grows the pipe buffer so that a whole frame fits in as few transfers as possible.
+	// Failure is harmless (not a pipe, or above /proc/sys/fs/pipe-max-size).
+	inline void growPipe(int fd, size_t frameSize)
+	{
+#ifdef F_SETPIPE_SZ
+		const size_t maxPipeSize = 1 << 20;
+		fcntl(fd, F_SETPIPE_SZ, (int)(frameSize < maxPipeSize ? frameSize : maxPipeSize));
+#else
+		(void)fd;
+		(void)frameSize;
+#endif
+	}
+
+	inline size_t y4mChromaSize(const std::string& colorspace, int width, int height)
+	{
+		size_t halfWidth = (size_t)(width + 1) / 2;
+		size_t halfHeight = (size_t)(height + 1) / 2;
+
+		// 8-bit layouts only, e.g. C420p10 or C444alpha are rejected
+		if (colorspace.empty() || colorspace == "420" || colorspace == "420jpeg" || colorspace == "420paldv" || colorspace == "420mpeg2") {
+			return 2 * halfWidth * halfHeight;
+		}
+		if (colorspace == "422") {
+			return 2 * halfWidth * height;
+		}
+		if (colorspace == "444") {
+			return 2 * (size_t)width * height;
+		}
+		if (colorspace == "mono") {
+			return 0;
+		}
+
+		throw std::runtime_error("Unsupported Y4M colorspace C" + colorspace);
+	}
+}
+
+class RawVideoReader
+{
+public:
+	RawVideoReader() = delete;
+	// width/height are required for Gray and YUV420P and ignored for Y4M,
+	// which takes them from the stream header.
+	RawVideoReader(int fd, StreamFormat format, int width, int height) :
+		fd_(fd)
+	{
+		info_.format = format;
+		info_.width = width;
+		info_.height = height;
+		info_.chromaSize = 0;
+
+		switch (format) {
+		case StreamFormat::Gray:
+			break;
+		case StreamFormat::YUV420P:
+			info_.chromaSize = rawstream::y4mChromaSize("420", width, height);
+			break;
+		case StreamFormat::Y4M:
+			readY4MHeader();
+			break;
+		}
+
+		if (info_.width < 1 || info_.height < 1) {
+			throw std::runtime_error("Stream size must be positive");
+		}
+
+		luma_.resize(info_.lumaSize());
+		chroma_.resize(info_.chromaSize);
+		rawstream::growPipe(fd_, info_.lumaSize() + info_.chromaSize);
+	}
+
+	const StreamInfo& info() const { return info_; }
+	const unsigned char* luma() const { return &luma_[0]; }
+
+	// Reads the next frame. Returns false at a clean end of stream,
+	// throws if the stream ends in the middle of a frame.
+	bool read()
+	{
+		if (info_.format == StreamFormat::Y4M) {
+			if (readY4MFrameHeader() == false) {
+				return false;
+			}
+			readRequired(&luma_[0], luma_.size());
+		}
+		else if (readFully(&luma_[0], luma_.size()) == false) {
+			return false;
+		}
+
+		readRequired(chroma_.data(), chroma_.size());
+		return true;
+	}
+
+private:
+	// Returns false if the stream ends before the first byte
+	bool readFully(void* dst, size_t size)
+	{
+		unsigned char* p = (unsigned char*)dst;
+		size_t done = 0;
+
+		while (done < size) {
+			ssize_t n = ::read(fd_, p + done, size - done);
+			if (n > 0) {
+				done += (size_t)n;
+			}
+			else if (n == 0) {
+				if (done == 0) {
+					return false;
+				}
+				throw std::runtime_error("Unexpected end of stream in the middle of a frame");
+			}
+			else if (errno != EINTR) {
+				throw std::runtime_error(std::string("read: ") + strerror(errno));
+			}
+		}
+
+		return true;
+	}
+
+	void readRequired(void* dst, size_t size)
+	{
+		if (size > 0 && readFully(dst, size) == false) {
+			throw std::runtime_error("Unexpected end of stream in the middle of a frame");
+		}
+	}
+
+	// Reads up to and excluding '\n'. Returns false at end of stream before any byte.
+	bool readLine(std::string& line, size_t maxLength)
+	{
+		line.clear();
+		char c;
+		while (true) {
+			if (readFully(&c, 1) == false) {
+				if (line.empty()) {
+					return false;
+				}
+				throw std::runtime_error("Unexpected end of stream in a Y4M header");
+			}
+			if (c == '\n') {
+				return true;
+			}
+			if (line.size() >= maxLength) {
+				throw std::runtime_error("Y4M header is too long");
+			}
+			line.push_back(c);
+		}
+	}
+
+	void readY4MHeader()
+	{
+		std::string header;
+		if (readLine(header, 1024) == false || header.compare(0, 10, "YUV4MPEG2 ") != 0) {
+			throw std::runtime_error("Input is not a YUV4MPEG2 stream");
+		}
+
+		std::string colorspace;
+		std::istringstream tokens(header.substr(10));
+		std::string token;
+		while (tokens >> token) {
+			switch (token[0]) {
+			case 'W': info_.width = atoi(token.c_str() + 1);	break;
+			case 'H': info_.height = atoi(token.c_str() + 1);	break;
+			case 'C': colorspace = token.substr(1);				break;
+			}
+		}
+
+		info_.chromaSize = rawstream::y4mChromaSize(colorspace, info_.width, info_.height);
+		info_.y4mHeader = header;
+	}
+
+	// "FRAME" optionally followed by parameters, up to '\n'
+	bool readY4MFrameHeader()
+	{
+		char tag[6];
+		if (readFully(tag, sizeof(tag)) == false) {
+			return false;
+		}
+		if (memcmp(tag, "FRAME", 5) != 0) {
+			throw std::runtime_error("Missing Y4M FRAME marker");
+		}
+		if (tag[5] != '\n') {
+			readLine(frameParams_, 1024);
+		}
+
+		return true;
+	}
+
+	int fd_;
+	StreamInfo info_;
+	std::vector<unsigned char> luma_;
+	std::vector<unsigned char> chroma_;
+	std::string frameParams_;
+};
+
+class RawVideoWriter
+{
+public:
+	RawVideoWriter() = delete;
+	RawVideoWriter(int fd, const StreamInfo& info) :
+		fd_(fd),
+		info_(info),
+		neutralChroma_(info.chromaSize, 128)
+	{
+		rawstream::growPipe(fd_, info_.lumaSize() + info_.chromaSize);
+
+		if (info_.format == StreamFormat::Y4M) {
+			std::string header = info_.y4mHeader + "\n";
+			if (writeAll(header.c_str(), header.size()) == false) {
+				throw std::runtime_error("Can not write the Y4M stream header");
+			}
+		}
+	}
+
+	// Writes one frame with the given luma plane (width bytes per row).
+	// Returns false once the reader has gone away.
+	bool write(const unsigned char* luma)
+	{
+		static const char frameTag[] = "FRAME\n";
+
+		struct iovec iov[3];
+		int count = 0;
+		if (info_.format == StreamFormat::Y4M) {
+			iov[count].iov_base = (void*)frameTag;
+			iov[count++].iov_len = sizeof(frameTag) - 1;
+		}
+		iov[count].iov_base = (void*)luma;
+		iov[count++].iov_len = info_.lumaSize();
+		if (info_.chromaSize > 0) {
+			iov[count].iov_base = (void*)&neutralChroma_[0];
+			iov[count++].iov_len = info_.chromaSize;
+		}
+
+		return writeAllv(iov, count);
+	}
+
+private:
+	bool writeAll(const void* src, size_t size)
+	{
+		struct iovec iov;
+		iov.iov_base = (void*)src;
+		iov.iov_len = size;
+
+		return writeAllv(&iov, 1);
+	}
+
+	bool writeAllv(struct iovec* iov, int count)
+	{
+		while (count > 0) {
+			ssize_t n = ::writev(fd_, iov, count);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno == EPIPE) {
+					return false;
+				}
+				throw std::runtime_error(std::string("write: ") + strerror(errno));
+			}
+
+			// Skip what was written, possibly stopping in the middle of a vector
+			size_t written = (size_t)n;
+			while (count > 0 && written >= iov->iov_len) {
+				written -= iov->iov_len;
+				++iov;
+				--count;
+			}
+			if (count > 0) {
+				iov->iov_base = (char*)iov->iov_base + written;
+				iov->iov_len -= written;
+			}
+		}
+
+		return true;
+	}
+
+	int fd_;
+	StreamInfo info_;
+	std::vector<unsigned char> neutralChroma_;
+};
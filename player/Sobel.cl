@@ -27,4 +27,375 @@ kernel void sobel(__read_only image2d_t src, __write_only image2d_t dst)
 
     uint gradient = abs(gx) + abs(gy);
     write_imageui(dst, coord, (uint4)(max(min(gradient, (uint)255), (uint)0), 0, 0, 255));
-}
\ No newline at end of file
+}
+
+//------------------------------------------------------------------
+// Canny edge detector
+//
+// canny_blur -> canny_gradient -> canny_nms -> canny_hysteresis (repeated) -> canny_finalize
+// Every intermediate stays in device memory, only the final edge map is read back.
+// Tiled frames keep the edge states on the host between tiles, see CLContext::canny.
+// The CPU backend runs the same steps (simple_sobel.h) and finds the same edges.
+
+#define CANNY_WEAK      128
+#define CANNY_STRONG    255
+
+#ifndef CANNY_TILE
+#define CANNY_TILE      16
+#endif
+
+// Same 5x5 kernel as gaussian_blur_operator, normalized by 159 rounding to nearest
+// (canny_blur_operator in simple_sobel.h)
+__constant int gaussian5x5[25] = {
+    2,  4,  5,  4, 2,
+    4,  9, 12,  9, 4,
+    5, 12, 15, 12, 5,
+    4,  9, 12,  9, 4,
+    2,  4,  5,  4, 2
+};
+
+// Neighbour offset along the gradient for each quantized direction
+// 0: horizontal, 1: diagonal (\), 2: vertical, 3: anti-diagonal (/)
+__constant int2 cannyDirection[4] = { (int2)(1, 0), (int2)(1, 1), (int2)(0, 1), (int2)(1, -1) };
+
+kernel void canny_blur(__read_only image2d_t src, __write_only image2d_t dst)
+{
+    int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    int width = get_image_width(dst);
+
+    if (coord.x >= width) {
+        return;
+    }
+
+    int sum = 0;
+    #pragma unroll
+    for (int j = 0; j < 5; ++j) {
+        #pragma unroll
+        for (int i = 0; i < 5; ++i) {
+            sum += gaussian5x5[j * 5 + i] * (int)read_imageui(src, sampler, coord + (int2)(i - 2, j - 2)).x;
+        }
+    }
+
+    write_imageui(dst, coord, (uint4)(min((sum + 159 / 2) / 159, 255), 0, 0, 255));
+}
+
+// Writes (squared magnitude << 2) | direction for every pixel.
+// The squared magnitude is exact, so no sqrt is needed anywhere in the pipeline.
+kernel void canny_gradient(__read_only image2d_t src, __global uint* gradient)
+{
+    int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    int width = get_image_width(src);
+
+    if (coord.x >= width) {
+        return;
+    }
+
+    int p00 = read_imageui(src, sampler, (int2)(coord.x - 1, coord.y - 1)).x;
+    int p10 = read_imageui(src, sampler, (int2)(coord.x    , coord.y - 1)).x;
+    int p20 = read_imageui(src, sampler, (int2)(coord.x + 1, coord.y - 1)).x;
+
+    int p01 = read_imageui(src, sampler, (int2)(coord.x - 1, coord.y)).x;
+    int p21 = read_imageui(src, sampler, (int2)(coord.x + 1, coord.y)).x;
+
+    int p02 = read_imageui(src, sampler, (int2)(coord.x - 1, coord.y + 1)).x;
+    int p12 = read_imageui(src, sampler, (int2)(coord.x    , coord.y + 1)).x;
+    int p22 = read_imageui(src, sampler, (int2)(coord.x + 1, coord.y + 1)).x;
+
+    int gx = -p00 + p20 + ((p21 - p01) << 1) - p02 + p22;
+    int gy = -p00 - p20 + ((p12 - p10) << 1) + p02 + p22;
+
+    // Quantize the gradient angle with tan(22.5) in Q15, as in OpenCV
+    uint ax = abs(gx);
+    uint ay = abs(gy);
+    uint tg22x = ax * 13573;
+    uint ay15 = ay << 15;
+    uint direction;
+    if (ay15 < tg22x) {
+        direction = 0;
+    }
+    else if (ay15 > tg22x + (ax << 16)) {
+        direction = 2;
+    }
+    else {
+        direction = ((gx ^ gy) < 0) ? 3 : 1;
+    }
+
+    gradient[coord.y * width + coord.x] = ((uint)(gx * gx + gy * gy) << 2) | direction;
+}
+
+inline uint canny_magnitude(__global const uint* gradient, int x, int y, int width, int height)
+{
+    if (x < 0 || x >= width || y < 0 || y >= height) {
+        return 0;
+    }
+    return gradient[y * width + x] >> 2;
+}
+
+// Non-maximum suppression along the gradient direction fused with the double threshold.
+// Thresholds are squared to match the stored magnitude. gradient and edges cover one tile
+// of width x height; only its core (x0, y0, x1, y1) is written.
+kernel void canny_nms(__global const uint* gradient, __global uchar* edges, int width, int height, uint lowSquared, uint highSquared,
+                      int4 core)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if (x < core.x || y < core.y || x >= core.z || y >= core.w) {
+        return;
+    }
+
+    uint g = gradient[y * width + x];
+    uint magnitude = g >> 2;
+    int2 d = cannyDirection[g & 3];
+
+    uint m1 = canny_magnitude(gradient, x + d.x, y + d.y, width, height);
+    uint m2 = canny_magnitude(gradient, x - d.x, y - d.y, width, height);
+
+    uchar result = 0;
+    if (magnitude > lowSquared && magnitude > m1 && magnitude >= m2) {
+        result = magnitude > highSquared ? CANNY_STRONG : CANNY_WEAK;
+    }
+
+    edges[y * width + x] = result;
+}
+
+// Promotes weak pixels connected to strong ones. Each work-group propagates inside its
+// CANNY_TILE square in local memory until it is stable, so one launch covers a whole
+// square; the host relaunches while changed is set to carry edges across squares (and
+// across frame tiles, see CLContext::canny). CLContext picks CANNY_TILE from the
+// CL_KERNEL_WORK_GROUP_SIZE of this kernel.
+kernel __attribute__((reqd_work_group_size(CANNY_TILE, CANNY_TILE, 1)))
+void canny_hysteresis(__global uchar* edges, int width, int height, __global int* changed)
+{
+    __local uchar tile[CANNY_TILE + 2][CANNY_TILE + 2];
+    __local int tileChanged;
+
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+    int originX = get_group_id(0) * CANNY_TILE - 1;
+    int originY = get_group_id(1) * CANNY_TILE - 1;
+
+    for (int i = ly * CANNY_TILE + lx; i < (CANNY_TILE + 2) * (CANNY_TILE + 2); i += CANNY_TILE * CANNY_TILE) {
+        int tx = i % (CANNY_TILE + 2);
+        int ty = i / (CANNY_TILE + 2);
+        int x = originX + tx;
+        int y = originY + ty;
+        tile[ty][tx] = (x >= 0 && x < width && y >= 0 && y < height) ? edges[y * width + x] : 0;
+    }
+
+    int tx = lx + 1;
+    int ty = ly + 1;
+    bool promoted = false;
+
+    while (true) {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (lx == 0 && ly == 0) {
+            tileChanged = 0;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if (tile[ty][tx] == CANNY_WEAK) {
+            if (tile[ty - 1][tx - 1] == CANNY_STRONG || tile[ty - 1][tx] == CANNY_STRONG || tile[ty - 1][tx + 1] == CANNY_STRONG ||
+                tile[ty    ][tx - 1] == CANNY_STRONG ||                                       tile[ty    ][tx + 1] == CANNY_STRONG ||
+                tile[ty + 1][tx - 1] == CANNY_STRONG || tile[ty + 1][tx] == CANNY_STRONG || tile[ty + 1][tx + 1] == CANNY_STRONG)
+            {
+                tile[ty][tx] = CANNY_STRONG;
+                tileChanged = 1;
+                promoted = true;
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // Every work-item reads the same value here, so the loop exits uniformly
+        if (tileChanged == 0) {
+            break;
+        }
+    }
+
+    if (promoted) {
+        edges[(originY + ty) * width + originX + tx] = CANNY_STRONG;
+        *changed = 1;
+    }
+}
+
+// Maps the edge states to 0/255 in dst, which has the size of edges
+kernel void canny_finalize(__global const uchar* edges, __write_only image2d_t dst)
+{
+    int2 coord = (int2)(get_global_id(0), get_global_id(1));
+
+    if (coord.x >= get_image_width(dst) || coord.y >= get_image_height(dst)) {
+        return;
+    }
+
+    uint value = edges[coord.y * get_image_width(dst) + coord.x] == CANNY_STRONG ? 255 : 0;
+    write_imageui(dst, coord, (uint4)(value, 0, 0, 255));
+}
+
+//------------------------------------------------------------------
+// Edge statistics
+//
+// sobel_stats computes the same magnitude as the sobel kernel and reduces it
+// per work-group in local memory, so only the small stats buffer is written
+// and read back; the edge image itself never leaves the device (or exists).
+//
+// stats layout (uint, zeroed by the host before every frame) :
+//   [STATS_EDGES]       pixels with magnitude >= edgeThreshold
+//   [STATS_SUM_LOW/HIGH] 64-bit sum of the magnitude over the frame
+//   [STATS_ORIENTATION] STATS_BINS gradient direction bins of the edge pixels
+//   [STATS_REGIONS]     edge pixels in each of STATS_GRID x STATS_GRID regions, row-major
+//
+// src may be one tile of a larger frame : only its core (x0, y0, x1, y1) is counted,
+// and regions are placed with the tile origin (frame.xy) and the frame size (frame.zw).
+
+#ifndef STATS_TILE
+#define STATS_TILE      16
+#endif
+#ifndef STATS_GRID
+#define STATS_GRID      8
+#endif
+#define STATS_BINS      8
+
+#define STATS_EDGES         0
+#define STATS_SUM_LOW       1
+#define STATS_SUM_HIGH      2
+#define STATS_ORIENTATION   3
+#define STATS_REGIONS       (STATS_ORIENTATION + STATS_BINS)
+#define STATS_SIZE          (STATS_REGIONS + STATS_GRID * STATS_GRID)
+
+// 22.5 degree bins over [0, 180), measured from +x towards +y (down).
+// Integer only (tan(22.5) in Q15) so that the host reduction bins identically.
+inline int orientation_bin(int gx, int gy)
+{
+    if (gy < 0 || (gy == 0 && gx < 0)) {
+        gx = -gx;
+        gy = -gy;
+    }
+
+    int ax = abs(gx);
+    if (gx > 0) {
+        // [0, 90) : upper bound of each bin is excluded
+        if (gy * 32768 < ax * 13573)    return 0;
+        if (gy < ax)                    return 1;
+        if (gy * 13573 < ax * 32768)    return 2;
+        return 3;
+    }
+
+    // [90, 180), mirrored : the lower bound of each bin is included
+    if (gy * 32768 <= ax * 13573)   return 7;
+    if (gy <= ax)                   return 6;
+    if (gy * 13573 <= ax * 32768)   return 5;
+    return 4;
+}
+
+kernel __attribute__((reqd_work_group_size(STATS_TILE, STATS_TILE, 1)))
+void sobel_stats(__read_only image2d_t src, __global uint* stats, int edgeThreshold, int4 core, int4 frame)
+{
+    __local uint sums[STATS_TILE * STATS_TILE];
+    __local uint counts[STATS_TILE * STATS_TILE];
+    __local uint histogram[STATS_SIZE];
+
+    int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    int lid = get_local_id(1) * STATS_TILE + get_local_id(0);
+
+    for (int i = lid; i < STATS_SIZE; i += STATS_TILE * STATS_TILE) {
+        histogram[i] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    uint magnitude = 0;
+    uint edge = 0;
+    if (coord.x >= core.x && coord.y >= core.y && coord.x < core.z && coord.y < core.w) {
+        int p00 = read_imageui(src, sampler, (int2)(coord.x - 1, coord.y - 1)).x;
+        int p10 = read_imageui(src, sampler, (int2)(coord.x    , coord.y - 1)).x;
+        int p20 = read_imageui(src, sampler, (int2)(coord.x + 1, coord.y - 1)).x;
+
+        int p01 = read_imageui(src, sampler, (int2)(coord.x - 1, coord.y)).x;
+        int p21 = read_imageui(src, sampler, (int2)(coord.x + 1, coord.y)).x;
+
+        int p02 = read_imageui(src, sampler, (int2)(coord.x - 1, coord.y + 1)).x;
+        int p12 = read_imageui(src, sampler, (int2)(coord.x    , coord.y + 1)).x;
+        int p22 = read_imageui(src, sampler, (int2)(coord.x + 1, coord.y + 1)).x;
+
+        int gx = -p00 + p20 + ((p21 - p01) << 1) - p02 + p22;
+        int gy = -p00 - p20 + ((p12 - p10) << 1) + p02 + p22;
+
+        magnitude = min((uint)(abs(gx) + abs(gy)), (uint)255);
+        if (magnitude >= (uint)edgeThreshold) {
+            edge = 1;
+            int region = ((frame.y + coord.y) * STATS_GRID / frame.w) * STATS_GRID + (frame.x + coord.x) * STATS_GRID / frame.z;
+            atomic_inc(&histogram[STATS_ORIENTATION + orientation_bin(gx, gy)]);
+            atomic_inc(&histogram[STATS_REGIONS + region]);
+        }
+    }
+    sums[lid] = magnitude;
+    counts[lid] = edge;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Tree reduction of the sum and the edge count
+    for (int stride = STATS_TILE * STATS_TILE / 2; stride > 0; stride >>= 1) {
+        if (lid < stride) {
+            sums[lid] += sums[lid + stride];
+            counts[lid] += counts[lid + stride];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // One global atomic per work-group and non-empty counter.
+    // The sum carries into the high word by hand, 64-bit atomics are an extension.
+    if (lid == 0) {
+        if (counts[0] != 0) {
+            atomic_add(&stats[STATS_EDGES], counts[0]);
+        }
+        uint old = atomic_add(&stats[STATS_SUM_LOW], sums[0]);
+        if (old + sums[0] < old) {
+            atomic_inc(&stats[STATS_SUM_HIGH]);
+        }
+    }
+    for (int i = STATS_ORIENTATION + lid; i < STATS_SIZE; i += STATS_TILE * STATS_TILE) {
+        if (histogram[i] != 0) {
+            atomic_add(&stats[i], histogram[i]);
+        }
+    }
+}
+
+//------------------------------------------------------------------
+// Colour Sobel
+//
+// Packed 3-byte pixels (BGR) are not an image format, so the frame stays in a
+// buffer as uploaded from the host and each neighbour is one vload3 : the three
+// channels go through the gradient together as an int3. Borders are replicated
+// like the sampler of sobel, so a grey frame gives the same result as sobel.
+
+kernel void sobel_color(__global const uchar* src, __write_only image2d_t dst, int width, int height, int sumChannels)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if (x >= width || y >= height) {
+        return;
+    }
+
+    int left = max(x - 1, 0);
+    int right = min(x + 1, width - 1);
+    __global const uchar* above = src + max(y - 1, 0) * width * 3;
+    __global const uchar* row = src + y * width * 3;
+    __global const uchar* below = src + min(y + 1, height - 1) * width * 3;
+
+    int3 p00 = convert_int3(vload3(left, above));
+    int3 p10 = convert_int3(vload3(x, above));
+    int3 p20 = convert_int3(vload3(right, above));
+
+    int3 p01 = convert_int3(vload3(left, row));
+    int3 p21 = convert_int3(vload3(right, row));
+
+    int3 p02 = convert_int3(vload3(left, below));
+    int3 p12 = convert_int3(vload3(x, below));
+    int3 p22 = convert_int3(vload3(right, below));
+
+    int3 gx = -p00 + p20 + ((p21 - p01) << 1) - p02 + p22;
+    int3 gy = -p00 - p20 + ((p12 - p10) << 1) + p02 + p22;
+
+    uint3 gradient = min(abs(gx) + abs(gy), (uint3)255);
+    uint magnitude = sumChannels ? gradient.x + gradient.y + gradient.z : max(gradient.x, max(gradient.y, gradient.z));
+    write_imageui(dst, (int2)(x, y), (uint4)(min(magnitude, (uint)255), 0, 0, 255));
+}
@@ -0,0 +1,67 @@
+// Generic stencil kernel, specialized at build time by stencil::clBuildOptions<Op>().
+//
+//   KSIZE_A, COEFFS_A : size and row-major taps of the first kernel
+//   KSIZE_B, COEFFS_B : size and row-major taps of the second kernel (a single 0 when unused)
+//   COMBINE_L1 | COMBINE_L2 | COMBINE_ABS | COMBINE_HALF_SUM | COMBINE_NORMALIZE, DIVISOR : output policy
+//   BORDER_ZERO : zero padded borders instead of replicated edges
+//
+// Every tap is a compile-time constant, so the loops below are fully unrolled
+// and zero taps are dropped by the compiler.
+
+#ifdef BORDER_ZERO
+__constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP |
+                               CLK_FILTER_NEAREST;
+#else
+__constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                               CLK_ADDRESS_CLAMP_TO_EDGE |
+                               CLK_FILTER_NEAREST;
+#endif
+
+__constant int coeffsA[KSIZE_A * KSIZE_A] = { COEFFS_A };
+__constant int coeffsB[KSIZE_B * KSIZE_B] = { COEFFS_B };
+
+#define CONVOLVE(SIZE, COEFFS, RESULT)                                              \
+    _Pragma("unroll")                                                               \
+    for (int j = 0; j < SIZE; ++j) {                                                \
+        _Pragma("unroll")                                                           \
+        for (int i = 0; i < SIZE; ++i) {                                            \
+            const int c = COEFFS[j * SIZE + i];                                     \
+            if (c != 0) {                                                           \
+                int2 offset = (int2)(i - SIZE / 2, j - SIZE / 2);                   \
+                RESULT += c * (int)read_imageui(src, sampler, coord + offset).x;   \
+            }                                                                       \
+        }                                                                           \
+    }
+
+kernel void stencil(__read_only image2d_t src, __write_only image2d_t dst)
+{
+    int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    int width = get_image_width(dst);
+
+    if (coord.x >= width) {
+        return;
+    }
+
+    int a = 0;
+    int b = 0;
+    CONVOLVE(KSIZE_A, coeffsA, a)
+    CONVOLVE(KSIZE_B, coeffsB, b)
+
+#if defined(COMBINE_L1)
+    int value = abs(a) + abs(b);
+#elif defined(COMBINE_L2)
+    int value = (int)sqrt((float)(a * a + b * b));
+#elif defined(COMBINE_ABS)
+    int value = abs(a);
+#elif defined(COMBINE_HALF_SUM)
+    int sum = min(abs(a), 255) + min(abs(b), 255);
+    int value = (sum + ((sum >> 1) & 1)) >> 1;
+#elif defined(COMBINE_NORMALIZE)
+    int value = (int)(a * (1.0f / DIVISOR));
+#else
+#error "No combine policy defined"
+#endif
+
+    write_imageui(dst, coord, (uint4)(clamp(value, 0, 255), 0, 0, 255));
+}
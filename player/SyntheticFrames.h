@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Deterministic synthetic grey frames at any resolution, for benchmarks and for
+// feeding the player at sizes the sample videos do not cover. A frame only depends
+// on the pattern, the size, the seed and its index, so frames can be rendered in
+// any order and every run sees the same pixels.
+enum class SyntheticPattern : int
+{
+	Noise,		// uniform noise, new every frame : edges everywhere
+	Gradient,	// smooth diagonal ramp scrolling by one level per frame : almost no edges
+	Shapes,		// rectangles and discs moving over a ramp, bouncing off the frame border
+	Static		// the first Shapes frame, repeated
+};
+
+inline const char* patternName(SyntheticPattern pattern)
+{
+	switch (pattern) {
+	case SyntheticPattern::Noise:		return "noise";
+	case SyntheticPattern::Gradient:	return "gradient";
+	case SyntheticPattern::Shapes:		return "shapes";
+	case SyntheticPattern::Static:		return "static";
+	}
+
+	return "";
+}
+
+inline bool parsePattern(const char* name, SyntheticPattern& pattern)
+{
+	const SyntheticPattern patterns[] = { SyntheticPattern::Noise, SyntheticPattern::Gradient, SyntheticPattern::Shapes, SyntheticPattern::Static };
+
+	for (SyntheticPattern candidate : patterns) {
+		if (strcmp(name, patternName(candidate)) == 0) {
+			pattern = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+class SyntheticSource
+{
+public:
+	SyntheticSource(SyntheticPattern pattern, int width, int height, uint32_t seed = 1) :
+		pattern_(pattern),
+		width_(width),
+		height_(height),
+		seed_(seed),
+		columnRamp_(width)
+	{
+		for (int x = 0; x < width; ++x) {
+			columnRamp_[x] = (uint8_t)(x * 255 / std::max(width - 1, 1));
+		}
+
+		// About one shape per 256x256 pixels, at least 8 and at most 64
+		uint32_t state = mix(seed_ ^ 0x5bd1e995u);
+		int count = std::min(64, std::max(8, (int)((int64_t)width * height / (256 * 256))));
+		float extent = (float)std::min(width, height);
+		for (int i = 0; i < count; ++i) {
+			Shape shape;
+			shape.disc = (next(state) & 1) != 0;
+			shape.halfWidth = std::max(1.0f, extent * (0.01f + 0.07f * unit(state)));
+			shape.halfHeight = shape.disc ? shape.halfWidth : std::max(1.0f, extent * (0.01f + 0.07f * unit(state)));
+			shape.x = width * unit(state);
+			shape.y = height * unit(state);
+			// Up to 1% of the frame per frame in each direction
+			shape.vx = width * 0.01f * (2.0f * unit(state) - 1.0f);
+			shape.vy = height * 0.01f * (2.0f * unit(state) - 1.0f);
+			shape.level = (uint8_t)(next(state) & 255);
+			shapes_.push_back(shape);
+		}
+	}
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+
+	// Writes frame index into dst, stride in bytes
+	void render(int64_t index, unsigned char* dst, size_t stride) const
+	{
+		switch (pattern_) {
+		case SyntheticPattern::Noise:		renderNoise(index, dst, stride);		break;
+		case SyntheticPattern::Gradient:	renderGradient(index, dst, stride);		break;
+		case SyntheticPattern::Shapes:		renderShapes(index, dst, stride);		break;
+		case SyntheticPattern::Static:		renderShapes(0, dst, stride);			break;
+		}
+	}
+
+private:
+	struct Shape
+	{
+		bool disc;
+		float halfWidth, halfHeight;
+		float x, y;					// centre on frame 0
+		float vx, vy;				// pixels per frame
+		uint8_t level;
+	};
+
+	// Avalanche of a 32-bit value (murmur3 finalizer), used to seed independent streams
+	static uint32_t mix(uint32_t h)
+	{
+		h ^= h >> 16;
+		h *= 0x85ebca6bu;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h != 0 ? h : 1;
+	}
+
+	// xorshift32
+	static uint32_t next(uint32_t& state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	static float unit(uint32_t& state)
+	{
+		return (next(state) >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// Position of a point moving at velocity from start, reflected at 0 and limit
+	static float bounce(float start, float velocity, int64_t index, float limit)
+	{
+		if (limit <= 0.0f) {
+			return 0.0f;
+		}
+		double period = 2.0 * limit;
+		double u = std::fmod(start + (double)velocity * index, period);
+		if (u < 0.0) {
+			u += period;
+		}
+		return (float)(u <= limit ? u : period - u);
+	}
+
+	void renderNoise(int64_t index, unsigned char* dst, size_t stride) const
+	{
+		// One stream per row, so that rows do not depend on each other
+		uint32_t frameSeed = mix(seed_ ^ mix((uint32_t)index) ^ (uint32_t)(index >> 32));
+		for (int y = 0; y < height_; ++y) {
+			uint32_t state = mix(frameSeed + 0x9e3779b9u * (uint32_t)y);
+			unsigned char* row = dst + stride * y;
+			int x = 0;
+			for (; x + 4 <= width_; x += 4) {
+				uint32_t bits = next(state);
+				memcpy(row + x, &bits, 4);
+			}
+			for (uint32_t bits = next(state); x < width_; ++x, bits >>= 8) {
+				row[x] = (unsigned char)bits;
+			}
+		}
+	}
+
+	void renderGradient(int64_t index, unsigned char* dst, size_t stride) const
+	{
+		// Triangle wave over 0..255..0 so that the scrolling ramp never wraps into a step
+		const int phase = (int)(index % 510);
+		for (int y = 0; y < height_; ++y) {
+			const int rowLevel = y * 255 / std::max(height_ - 1, 1);
+			unsigned char* row = dst + stride * y;
+			for (int x = 0; x < width_; ++x) {
+				int v = ((columnRamp_[x] + rowLevel) / 2 + phase) % 510;
+				row[x] = (unsigned char)(v <= 255 ? v : 510 - v);
+			}
+		}
+	}
+
+	void renderShapes(int64_t index, unsigned char* dst, size_t stride) const
+	{
+		// Dim ramp background, 40..120
+		for (int y = 0; y < height_; ++y) {
+			const int rowLevel = y * 255 / std::max(height_ - 1, 1);
+			unsigned char* row = dst + stride * y;
+			for (int x = 0; x < width_; ++x) {
+				row[x] = (unsigned char)(40 + (columnRamp_[x] + rowLevel) * 80 / 510);
+			}
+		}
+
+		for (const Shape& shape : shapes_) {
+			float cx = shape.halfWidth + bounce(shape.x, shape.vx, index, width_ - 2.0f * shape.halfWidth);
+			float cy = shape.halfHeight + bounce(shape.y, shape.vy, index, height_ - 2.0f * shape.halfHeight);
+
+			int top = std::max(0, (int)std::ceil(cy - shape.halfHeight));
+			int bottom = std::min(height_ - 1, (int)std::floor(cy + shape.halfHeight));
+			for (int y = top; y <= bottom; ++y) {
+				float half = shape.halfWidth;
+				if (shape.disc) {
+					float dy = (y - cy) / shape.halfHeight;
+					half = shape.halfWidth * std::sqrt(std::max(0.0f, 1.0f - dy * dy));
+				}
+
+				int left = std::max(0, (int)std::ceil(cx - half));
+				int right = std::min(width_ - 1, (int)std::floor(cx + half));
+				if (left <= right) {
+					memset(dst + stride * y + left, shape.level, right - left + 1);
+				}
+			}
+		}
+	}
+
+	SyntheticPattern pattern_;
+	int width_;
+	int height_;
+	uint32_t seed_;
+	std::vector<uint8_t> columnRamp_;
+	std::vector<Shape> shapes_;
+};
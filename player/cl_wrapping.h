@@ -3,6 +3,7 @@
 #define CL_TARGET_OPENCL_VERSION 120
 
 #include <CL/cl.h>
+#include <atomic>
 #include <stdexcept>
 #include <sstream>
 #include <string>
@@ -266,6 +267,63 @@ namespace cl
 		THROW_ERROR_EXCEPTION(errCode)
 	}
 
+	void enqueueReadBufferRect(
+		cl_command_queue command_queue,
+		cl_mem buffer,
+		cl_bool blocking_read,
+		const size_t* buffer_origin,
+		const size_t* host_origin,
+		const size_t* region,
+		size_t buffer_row_pitch,
+		size_t buffer_slice_pitch,
+		size_t host_row_pitch,
+		size_t host_slice_pitch,
+		void* ptr,
+		cl_uint num_events_in_wait_list = 0,
+		const cl_event* event_wait_list = nullptr,
+		cl_event* event = nullptr)
+	{
+		cl_int errCode = clEnqueueReadBufferRect(command_queue, buffer, blocking_read, buffer_origin, host_origin, region,
+			buffer_row_pitch, buffer_slice_pitch, host_row_pitch, host_slice_pitch, ptr, num_events_in_wait_list, event_wait_list, event);
+		THROW_ERROR_EXCEPTION(errCode)
+	}
+
+	void enqueueWriteBufferRect(
+		cl_command_queue command_queue,
+		cl_mem buffer,
+		cl_bool blocking_write,
+		const size_t* buffer_origin,
+		const size_t* host_origin,
+		const size_t* region,
+		size_t buffer_row_pitch,
+		size_t buffer_slice_pitch,
+		size_t host_row_pitch,
+		size_t host_slice_pitch,
+		const void* ptr,
+		cl_uint num_events_in_wait_list = 0,
+		const cl_event* event_wait_list = nullptr,
+		cl_event* event = nullptr)
+	{
+		cl_int errCode = clEnqueueWriteBufferRect(command_queue, buffer, blocking_write, buffer_origin, host_origin, region,
+			buffer_row_pitch, buffer_slice_pitch, host_row_pitch, host_slice_pitch, ptr, num_events_in_wait_list, event_wait_list, event);
+		THROW_ERROR_EXCEPTION(errCode)
+	}
+
+	void enqueueFillBuffer(
+		cl_command_queue command_queue,
+		cl_mem buffer,
+		const void* pattern,
+		size_t pattern_size,
+		size_t offset,
+		size_t size,
+		cl_uint num_events_in_wait_list = 0,
+		const cl_event* event_wait_list = nullptr,
+		cl_event* event = nullptr)
+	{
+		cl_int errCode = clEnqueueFillBuffer(command_queue, buffer, pattern, pattern_size, offset, size, num_events_in_wait_list, event_wait_list, event);
+		THROW_ERROR_EXCEPTION(errCode)
+	}
+
 	void enqueueFillImage(
 		cl_command_queue command_queue,
 		cl_mem image,
@@ -401,4 +459,220 @@ namespace cl
 		cl_int errCode = clFinish(command_queue);
 		THROW_ERROR_EXCEPTION(errCode)
 	}
+
+	//------------------------------------------------------------------
+	// RAII handles
+	//
+	// Move-only owners of one reference to a cl_* object, released on destruction
+	// or reassignment. Every handle type keeps created/released counters and memory
+	// objects also track their device size, so handleReport() shows whether a
+	// long-running session holds a flat number of objects.
+	// Devices are not wrapped : root devices from clGetDeviceIDs are not reference counted.
+
+	enum HandleKind
+	{
+		CONTEXT_HANDLE,
+		QUEUE_HANDLE,
+		PROGRAM_HANDLE,
+		KERNEL_HANDLE,
+		MEM_HANDLE,
+		EVENT_HANDLE,
+
+		HANDLE_KIND_COUNT
+	};
+
+	struct HandleCounters
+	{
+		std::atomic<long> created[HANDLE_KIND_COUNT];
+		std::atomic<long> released[HANDLE_KIND_COUNT];
+		std::atomic<long long> memBytes;
+
+		HandleCounters() : memBytes(0)
+		{
+			for (int i = 0; i < HANDLE_KIND_COUNT; ++i) {
+				created[i] = 0;
+				released[i] = 0;
+			}
+		}
+	};
+
+	inline HandleCounters& handleCounters()
+	{
+		static HandleCounters counters;
+		return counters;
+	}
+
+	inline long long memObjectSize(cl_mem memobj)
+	{
+		size_t size = 0;
+		clGetMemObjectInfo(memobj, CL_MEM_SIZE, sizeof(size_t), &size, nullptr);
+		return (long long)size;
+	}
+
+	// Bytes copied between host and device, counted by the callers of the enqueue functions
+	struct TransferCounters
+	{
+		std::atomic<unsigned long long> uploaded;
+		std::atomic<unsigned long long> downloaded;
+
+		TransferCounters() : uploaded(0), downloaded(0) {}
+	};
+
+	inline TransferCounters& transferCounters()
+	{
+		static TransferCounters counters;
+		return counters;
+	}
+
+	inline void countTransfer(size_t uploaded, size_t downloaded)
+	{
+		TransferCounters& counters = transferCounters();
+		counters.uploaded.fetch_add(uploaded, std::memory_order_relaxed);
+		counters.downloaded.fetch_add(downloaded, std::memory_order_relaxed);
+	}
+
+	template <class T>
+	struct HandleTraits;
+
+	template <>
+	struct HandleTraits<cl_context>
+	{
+		static constexpr HandleKind kind = CONTEXT_HANDLE;
+		static void created(cl_context) {}
+		static void release(cl_context handle) { clReleaseContext(handle); }
+	};
+
+	template <>
+	struct HandleTraits<cl_command_queue>
+	{
+		static constexpr HandleKind kind = QUEUE_HANDLE;
+		static void created(cl_command_queue) {}
+		static void release(cl_command_queue handle) { clReleaseCommandQueue(handle); }
+	};
+
+	template <>
+	struct HandleTraits<cl_program>
+	{
+		static constexpr HandleKind kind = PROGRAM_HANDLE;
+		static void created(cl_program) {}
+		static void release(cl_program handle) { clReleaseProgram(handle); }
+	};
+
+	template <>
+	struct HandleTraits<cl_kernel>
+	{
+		static constexpr HandleKind kind = KERNEL_HANDLE;
+		static void created(cl_kernel) {}
+		static void release(cl_kernel handle) { clReleaseKernel(handle); }
+	};
+
+	template <>
+	struct HandleTraits<cl_mem>
+	{
+		static constexpr HandleKind kind = MEM_HANDLE;
+		static void created(cl_mem handle) { handleCounters().memBytes += memObjectSize(handle); }
+		static void release(cl_mem handle)
+		{
+			handleCounters().memBytes -= memObjectSize(handle);
+			clReleaseMemObject(handle);
+		}
+	};
+
+	template <>
+	struct HandleTraits<cl_event>
+	{
+		static constexpr HandleKind kind = EVENT_HANDLE;
+		static void created(cl_event) {}
+		static void release(cl_event handle) { clReleaseEvent(handle); }
+	};
+
+	template <class T>
+	class Handle
+	{
+	public:
+		Handle() : handle_(nullptr) {}
+
+		// Takes ownership of a handle returned by a clCreate* / clEnqueue* call
+		explicit Handle(T handle) : handle_(handle)
+		{
+			if (handle_ != nullptr) {
+				++handleCounters().created[HandleTraits<T>::kind];
+				HandleTraits<T>::created(handle_);
+			}
+		}
+
+		~Handle()
+		{
+			reset();
+		}
+
+		Handle(Handle&& other) noexcept : handle_(other.handle_)
+		{
+			other.handle_ = nullptr;
+		}
+
+		Handle& operator=(Handle&& other) noexcept
+		{
+			if (this != &other) {
+				reset();
+				handle_ = other.handle_;
+				other.handle_ = nullptr;
+			}
+			return *this;
+		}
+
+		Handle(const Handle&) = delete;
+		Handle& operator=(const Handle&) = delete;
+
+		// Release errors are ignored : there is nothing left to do with the object
+		void reset()
+		{
+			if (handle_ != nullptr) {
+				HandleTraits<T>::release(handle_);
+				++handleCounters().released[HandleTraits<T>::kind];
+				handle_ = nullptr;
+			}
+		}
+
+		T get() const { return handle_; }
+		operator T() const { return handle_; }
+
+		// For clSetKernelArg and event wait lists, which take the address of the raw handle
+		const T* address() const { return &handle_; }
+
+	private:
+		T handle_;
+	};
+
+	typedef Handle<cl_context> Context;
+	typedef Handle<cl_command_queue> CommandQueue;
+	typedef Handle<cl_program> Program;
+	typedef Handle<cl_kernel> Kernel;
+	typedef Handle<cl_mem> Mem;
+	typedef Handle<cl_event> Event;
+
+	inline void setKernelArg(cl_kernel kernel, cl_uint arg_index, const Mem& mem)
+	{
+		setKernelArg(kernel, arg_index, sizeof(cl_mem), mem.address());
+	}
+
+	// e.g. "context 1/1, queue 2/2, program 1/1, kernel 6/6, mem 8/8 (12.0 MiB), event 2/90000"
+	// as live/created per handle type
+	inline std::string handleReport()
+	{
+		const char* names[HANDLE_KIND_COUNT] = { "context", "queue", "program", "kernel", "mem", "event" };
+		HandleCounters& counters = handleCounters();
+
+		std::stringstream ss;
+		for (int i = 0; i < HANDLE_KIND_COUNT; ++i) {
+			long created = counters.created[i];
+			ss << (i > 0 ? ", " : "") << names[i] << " " << created - counters.released[i] << "/" << created;
+			if (i == MEM_HANDLE) {
+				ss.precision(1);
+				ss << std::fixed << " (" << counters.memBytes / (1024.0 * 1024.0) << " MiB)";
+			}
+		}
+
+		return ss.str();
+	}
 };
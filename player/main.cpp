@@ -1,11 +1,19 @@
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <algorithm>
+#include <memory>
+#include <stdexcept>
 #include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
 #include <opencv2/opencv.hpp>
 
-#include "simple_sobel.h"
-#include "CLContext.h"
+#include "vivante.h"
+#include "RawStream.h"
+#include "FrameRing.h"
+#include "Metrics.h"
 #include "Timer.h"
 
 using namespace cv;
@@ -16,25 +24,35 @@ constexpr int KEY_1		 = 49;
 constexpr int KEY_2		 = 50;
 constexpr int KEY_3		 = 51;
 constexpr int KEY_4		 = 52;
+constexpr int KEY_5		 = 53;
+constexpr int KEY_6		 = 54;
 constexpr int KEY_9		 = 57;
 constexpr int KEY_MINUS  = 45;
+constexpr int KEY_C		 = 99;
 
 constexpr const char* FILTER_CPU_STR 	= "CPU";
 constexpr const char* FILTER_OPENCV_STR = "OpenCV";
 constexpr const char* FILTER_OPENCL_STR = "OpenCL";
+constexpr const char* FILTER_FUSED_STR	= "Fused";
+constexpr const char* FILTER_AUTO_STR	= "Auto";
 
 float gFontSize_ = 1.0f;
 bool gIsLooping = false;
+bool gIsColor = false;
 
 enum class FilterContext : int
 {
 	None = -1, 	// Do not perform edge detection
 	Simple_Sobel,
 	OpenCV_Sobel,
-	OpenCL_Sobel
+	OpenCL_Sobel,
+	Fused_Sobel,
+	Auto_Sobel,	// fastest of the above, measured on the video
+
+	Count
 };
 
-bool readFrame(VideoCapture& videoStream, UMat& frame)
+bool readFrame(VideoCapture& videoStream, Mat& frame)
 {
 	videoStream >> frame;
 
@@ -45,49 +63,280 @@ bool readFrame(VideoCapture& videoStream, UMat& frame)
 	return true;
 }
 
-void opencv_sobel(UMat& frame, Timer& timer)
+vivante::ConstPlane toConstPlane(const Mat& mat)
 {
-	UMat grad_x, grad_y;
-	UMat abs_grad_x, abs_grad_y;
-	
-	std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
+	return { mat.data, mat.cols, mat.rows, mat.step };
+}
+
+vivante::ConstColorPlane toConstColorPlane(const Mat& mat)
+{
+	return { mat.data, mat.cols, mat.rows, mat.step };
+}
 
-	/// Gradient X
-	cv::Sobel(frame, grad_x, CV_16S, 1, 0);
-	cv::convertScaleAbs(grad_x, abs_grad_x);
+vivante::Plane toPlane(Mat& mat)
+{
+	return { mat.data, mat.cols, mat.rows, mat.step };
+}
+
+FrameMeta frameMeta(const vivante::Filter& filter, double filterTime_ms)
+{
+	FrameMeta meta = {};
+	meta.backend = (int32_t)filter.activeBackend();
+	meta.op = (int32_t)filter.op();
+	meta.filterTime_ms = filterTime_ms;
+	strncpy(meta.backendName, vivante::backendName(filter.activeBackend()), sizeof(meta.backendName) - 1);
+
+	return meta;
+}
+
+// Null with a warning when the backend can not run options.op,
+// throws when the backend can not be initialized
+std::unique_ptr<vivante::Filter> createFilter(vivante::Backend backend, int width, int height, const vivante::Options& options)
+{
+	try {
+		return std::unique_ptr<vivante::Filter>(new vivante::Filter(backend, width, height, options));
+	}
+	catch (const std::invalid_argument& e) {
+		// The backend exists but can not run this operator, leave it disabled
+		fprintf(stderr, "Warning(%s Setup) : %s \n", vivante::backendName(backend), e.what());
+		return nullptr;
+	}
+}
 
-	/// Gradient Y
-	cv::Sobel(frame, grad_y, CV_16S, 0, 1);
-	cv::convertScaleAbs(grad_y, abs_grad_y);
+bool parseFormat(const char* name, StreamFormat& format)
+{
+	if (strcmp(name, "gray") == 0)			format = StreamFormat::Gray;
+	else if (strcmp(name, "yuv420p") == 0)	format = StreamFormat::YUV420P;
+	else if (strcmp(name, "y4m") == 0)		format = StreamFormat::Y4M;
+	else return false;
+
+	return true;
+}
+
+// TCP port for --metrics-port, the whole argument must be a number in 1..65535
+bool parsePort(const char* text, int& port)
+{
+	char* end = nullptr;
+	long value = strtol(text, &end, 10);
+	if (end == text || *end != '\0' || value < 1 || value > 65535) {
+		return false;
+	}
+
+	port = (int)value;
+	return true;
+}
+
+void printStreamUsage()
+{
+	fprintf(stderr,
+		"Usage : ./player --stream [options] \n"
+		"  --format gray|yuv420p|y4m     input/output format (default y4m) \n"
+		"  --size WxH                    frame size, required for gray and yuv420p \n"
+		"  --backend CPU|OpenCV|OpenCL|Fused|Auto  (default CPU) \n"
+		"  --operator name               see ./player usage (default Sobel) \n"
+		"  --input path                  file or FIFO to read instead of stdin \n"
+		"  --output path                 file or FIFO to write instead of stdout \n"
+		"  --shm name                    also publish edge frames to a shared memory ring (e.g. /vivante) \n"
+		"  --shm-slots N                 ring depth (default 8) \n"
+		"  --stats                       write one JSON line of Sobel edge statistics per frame instead of video \n"
+		"  --edge-threshold N            edge magnitude for --stats (default 64) \n"
+		"  --cl-max-tile N               OpenCL tile size cap, tiles frames even below the device limits \n"
+		"  --blur-sigma S                Gaussian pre-filter before the operator, for noisy input (0..32, default 0 : off) \n"
+		"  --metrics-port N              serve Prometheus metrics on 127.0.0.1:N/metrics \n"
+		"  --metrics-json path           rewrite a JSON dump of the metrics every --metrics-interval seconds \n"
+		"  --metrics-interval N          JSON dump period in seconds (default 10) \n");
+}
+
+// One JSON object per line and frame, e.g.
+// {"frame":0,"edges":1234,"mean":12.5,"orientation":[8 counts],"density":[GRID*GRID fractions, row-major]}
+bool printStats(int fd, int frame, const vivante::EdgeStats& stats)
+{
+	std::string line;
 
-	// Total Gradient (approximate)
-	cv::addWeighted(abs_grad_x, 0.5, abs_grad_y, 0.5, 0, frame);
+	appendf(line, "{\"frame\":%d,\"edges\":%u,\"mean\":%.3f,\"orientation\":[", frame, stats.edgePixels, stats.meanGradient);
+	for (int i = 0; i < vivante::EdgeStats::ORIENTATION_BINS; ++i) {
+		appendf(line, "%s%u", i > 0 ? "," : "", stats.orientation[i]);
+	}
+	line += "],\"density\":[";
+	for (int i = 0; i < vivante::EdgeStats::GRID * vivante::EdgeStats::GRID; ++i) {
+		appendf(line, "%s%.4f", i > 0 ? "," : "", stats.regionDensity[i / vivante::EdgeStats::GRID][i % vivante::EdgeStats::GRID]);
+	}
+	line += "]}\n";
 
-	std::chrono::duration<double> elapsedTime_sec = std::chrono::system_clock::now() - start;
-	timer.update(elapsedTime_sec.count() * 1000.0);
+	return write(fd, line.c_str(), line.size()) == (ssize_t)line.size();
 }
 
-void simple_sobel(UMat& frame, int width, int height, Timer& timer)
+// Analytics only : the edge map is never produced or transferred
+int writeStats(RawVideoReader& reader, vivante::Filter& filter, int outputFd, Metrics& metrics)
 {
-	cv::Mat src(height, width, CV_8UC1);
-	cv::Mat dst(height, width, CV_8UC1);
+	const StreamInfo& info = reader.info();
+	vivante::ConstPlane src = { reader.luma(), info.width, info.height, (size_t)info.width };
 
-	frame.copyTo(src);
+	fprintf(stderr, "Edge statistics of %dx%d through %s \n", info.width, info.height, vivante::backendName(filter.backend()));
 
-	std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
+	Timer timer;
+	StageClock clock;
+	while (reader.read()) {
+		metrics.stage(Stage::Read, clock.lap());
 
-	sobel_operator(src.data, dst.data, width, height);
+		vivante::EdgeStats stats;
+		double filterTime_ms = filter.analyze(src, stats);
+		timer.update(filterTime_ms);
+		metrics.stage(Stage::Filter, clock.lap());
+		metrics.frame(filter.activeBackend(), filterTime_ms);
 
-	std::chrono::duration<double> elapsedTime_sec = std::chrono::system_clock::now() - start;
-	timer.update(elapsedTime_sec.count() * 1000.0);
+		if (printStats(outputFd, timer.frameCounter - 1, stats) == false) {
+			break;
+		}
+		metrics.stage(Stage::Write, clock.lap());
+	}
 
-	dst.copyTo(frame);
+	fprintf(stderr, "%d frames (analyze AVG:%.0lf FPS) \n", timer.frameCounter, timer.frameCounter > 0 ? timer.getAvgFPS() : 0.0);
+	return EXIT_SUCCESS;
 }
 
-void printLog(UMat& frame, const FilterContext& filterContext, Timer timer[])
+// Filters raw frames from stdin (or --input) to stdout (or --output).
+// stdout carries video, so every message goes to stderr.
+int runStream(int argc, char* argv[])
+{
+	StreamFormat format = StreamFormat::Y4M;
+	vivante::Backend backend = vivante::Backend::CPU;
+	vivante::Options options;
+	int width = 0, height = 0;
+	int inputFd = STDIN_FILENO;
+	int outputFd = STDOUT_FILENO;
+	const char* shmName = nullptr;
+	int shmSlots = 8;
+	bool statsOnly = false;
+	int metricsPort = 0;
+	const char* metricsJson = nullptr;
+	int metricsInterval = 10;
+	options.log = [](const std::string& message) { fprintf(stderr, "%s \n", message.c_str()); };
+
+	for (int i = 0; i < argc; ++i) {
+		const char* arg = argv[i];
+		if (strcmp(arg, "--stats") == 0) {
+			statsOnly = true;
+			continue;
+		}
+
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		bool valid = value != nullptr;
+
+		if (valid && strcmp(arg, "--format") == 0)			valid = parseFormat(value, format);
+		else if (valid && strcmp(arg, "--size") == 0)		valid = sscanf(value, "%dx%d", &width, &height) == 2;
+		else if (valid && strcmp(arg, "--backend") == 0)	valid = vivante::parseBackend(value, backend);
+		else if (valid && strcmp(arg, "--operator") == 0)	valid = vivante::parseOperator(value, options.op);
+		else if (valid && strcmp(arg, "--input") == 0)		valid = (inputFd = open(value, O_RDONLY)) >= 0;
+		else if (valid && strcmp(arg, "--output") == 0)		valid = (outputFd = open(value, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0;
+		else if (valid && strcmp(arg, "--shm") == 0)		shmName = value;
+		else if (valid && strcmp(arg, "--shm-slots") == 0)	valid = (shmSlots = atoi(value)) >= 2;
+		else if (valid && strcmp(arg, "--edge-threshold") == 0)	options.edgeThreshold = atoi(value);
+		else if (valid && strcmp(arg, "--cl-max-tile") == 0)	valid = (options.clMaxTileSize = atoi(value)) > 0;
+		else if (valid && strcmp(arg, "--blur-sigma") == 0)	options.blurSigma = (float)atof(value);
+		else if (valid && strcmp(arg, "--metrics-port") == 0)	valid = parsePort(value, metricsPort);
+		else if (valid && strcmp(arg, "--metrics-json") == 0)	metricsJson = value;
+		else if (valid && strcmp(arg, "--metrics-interval") == 0)	valid = (metricsInterval = atoi(value)) > 0;
+		else valid = false;
+
+		if (!valid) {
+			fprintf(stderr, "Invalid stream option %s %s \n", arg, value ? value : "");
+			printStreamUsage();
+			return EXIT_FAILURE;
+		}
+		++i;
+	}
+
+	if (statsOnly && shmName) {
+		fprintf(stderr, "--stats produces no edge frames to publish with --shm \n");
+		return EXIT_FAILURE;
+	}
+
+	// A closed downstream shows up as EPIPE from write() instead of killing us
+	signal(SIGPIPE, SIG_IGN);
+
+	try {
+		RawVideoReader reader(inputFd, format, width, height);
+		const StreamInfo& info = reader.info();
+
+		Metrics metrics;
+		std::unique_ptr<MetricsExporter> exporter;
+		if (metricsPort > 0 || metricsJson) {
+			metrics.watchQueues(inputFd, outputFd, info.lumaSize() + info.chromaSize);
+			exporter.reset(new MetricsExporter(metrics, metricsPort, metricsJson, metricsInterval));
+		}
+
+		vivante::Filter filter(backend, info.width, info.height, options);
+		if (statsOnly) {
+			return writeStats(reader, filter, outputFd, metrics);
+		}
+		RawVideoWriter writer(outputFd, info);
+
+		std::vector<unsigned char> edges(info.lumaSize());
+		vivante::ConstPlane src = { reader.luma(), info.width, info.height, (size_t)info.width };
+		vivante::Plane dst = { &edges[0], info.width, info.height, (size_t)info.width };
+
+		// With a ring, the filter renders straight into the shared slot and the
+		// stream output is written from there
+		std::unique_ptr<FrameRingProducer> ring;
+		if (shmName) {
+			ring.reset(new FrameRingProducer(shmName, info.width, info.height, shmSlots));
+		}
+
+		fprintf(stderr, "Streaming %dx%d through %s %s%s%s \n", info.width, info.height,
+			vivante::backendName(backend), vivante::operatorName(options.op), shmName ? " to shm " : "", shmName ? shmName : "");
+
+		Timer timer;
+		StageClock clock;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		while (reader.read()) {
+			metrics.stage(Stage::Read, clock.lap());
+			if (ring) {
+				dst.data = ring->beginFrame();
+			}
+
+			double filterTime_ms = filter.process(src, dst);
+			timer.update(filterTime_ms);
+			metrics.stage(Stage::Filter, clock.lap());
+			metrics.frame(filter.activeBackend(), filterTime_ms);
+
+			if (ring) {
+				ring->publish(frameMeta(filter, filterTime_ms));
+				metrics.stage(Stage::Publish, clock.lap());
+			}
+			if (writer.write(dst.data) == false) {
+				break;
+			}
+			metrics.stage(Stage::Write, clock.lap());
+		}
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		fprintf(stderr, "%d frames in %.2lf s (%.1lf FPS end to end, filter AVG:%.0lf FPS) \n",
+			timer.frameCounter, elapsed.count(), timer.frameCounter / elapsed.count(), timer.frameCounter > 0 ? timer.getAvgFPS() : 0.0);
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "Error(Stream) : %s \n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stderr, "OpenCL resources : %s \n", vivante::resourceReport().c_str());
+
+	return EXIT_SUCCESS;
+}
+
+// Rows from the top of the frame that printLog may draw into
+int overlayRows(int height)
+{
+	int baseline = 0;
+	getTextSize("Ag", cv::FONT_HERSHEY_SIMPLEX, gFontSize_, 2, &baseline);
+
+	return std::min(height, (int)(30.0 * gFontSize_) + baseline + 2);
+}
+
+void printLog(Mat& frame, const FilterContext& filterContext, Timer timer[])
 {
 	static FilterContext prevFilter = FilterContext::None;
-	const char* filterName[] = { FILTER_CPU_STR, FILTER_OPENCV_STR, FILTER_OPENCL_STR };
+	const char* filterName[] = { FILTER_CPU_STR, FILTER_OPENCV_STR, FILTER_OPENCL_STR, FILTER_FUSED_STR, FILTER_AUTO_STR };
 	char buffer[128] = "";
 
 	// if (prevFilter == FilterContext::None) {
@@ -96,8 +345,14 @@ void printLog(UMat& frame, const FilterContext& filterContext, Timer timer[])
 	// else {
 	if (prevFilter != FilterContext::None) {
 		int index = (int)prevFilter;
-		sprintf(buffer, "%6s %4.0lf FPS, AVG:%4.0lf, MIN:%4.0lf, MAX:%4.0lf", 
-			filterName[index], timer[index].currentFPS, timer[index].getAvgFPS(), timer[index].minFPS, timer[index].maxFPS);
+		// A filter that has not run yet (e.g. right after a reset) has no average
+		if (timer[index].frameCounter == 0) {
+			sprintf(buffer, "%6s    - FPS", filterName[index]);
+		}
+		else {
+			sprintf(buffer, "%6s %4.0lf FPS, AVG:%4.0lf, MIN:%4.0lf, MAX:%4.0lf", 
+				filterName[index], timer[index].currentFPS, timer[index].getAvgFPS(), timer[index].minFPS, timer[index].maxFPS);
+		}
 		// sprintf(buffer, "[%s] Min: %.2lf, Max: %.2lf, Avg: %.2lf, Now: %.2lf  (ms/frame)", 
 		// 	filterName[index], timer[index].minTime_ms, timer[index].maxTime_ms, timer[index].getAverageTime(), timer[index].currentTime_ms);
 	}
@@ -111,10 +366,50 @@ void printLog(UMat& frame, const FilterContext& filterContext, Timer timer[])
 int main(int argc, char* argv[])
 {
 	if (argc < 2) {
-		fprintf(stderr, "Usage : ./player video \n");
+		fprintf(stderr, "Usage : ./player video [Sobel|Scharr|Prewitt|Gaussian3x3|Gaussian5x5|Laplacian|Canny] [--shm name] \n"
+			"                [--blur-sigma S] [--metrics-port N] [--metrics-json path] [--metrics-interval N] \n");
+		printStreamUsage();
 		exit(EXIT_FAILURE);
 	}
 
+	if (strcmp(argv[1], "--stream") == 0) {
+		return runStream(argc - 2, argv + 2);
+	}
+
+	vivante::Options options;
+	options.log = [](const std::string& message) { printf("%s \n", message.c_str()); };
+	const char* shmName = nullptr;
+	int metricsPort = 0;
+	const char* metricsJson = nullptr;
+	int metricsInterval = 10;
+	for (int i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+			shmName = argv[++i];
+		}
+		else if (strcmp(argv[i], "--metrics-port") == 0 && i + 1 < argc) {
+			if (parsePort(argv[++i], metricsPort) == false) {
+				fprintf(stderr, "Invalid metrics port %s \n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strcmp(argv[i], "--metrics-json") == 0 && i + 1 < argc) {
+			metricsJson = argv[++i];
+		}
+		else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc) {
+			if ((metricsInterval = atoi(argv[++i])) <= 0) {
+				fprintf(stderr, "Invalid metrics interval %s \n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strcmp(argv[i], "--blur-sigma") == 0 && i + 1 < argc) {
+			options.blurSigma = (float)atof(argv[++i]);
+		}
+		else if (vivante::parseOperator(argv[i], options.op) == false) {
+			fprintf(stderr, "Unknown operator %s \n", argv[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	VideoCapture videoStream(argv[1]);
 	if (!videoStream.isOpened()) {
 		fprintf(stderr, "Failed to open file %s \n", argv[1]);
@@ -128,54 +423,152 @@ int main(int argc, char* argv[])
 
 	printf("Get video information successfully. \n");
 
-	CLContext* clContext = nullptr;
-	try {
-		clContext = new CLContext(videoWidth_, videoHeight_);
+	// FilterContext values double as indices into this array
+	const int numFilters = (int)FilterContext::Count;
+	const vivante::Backend backends[numFilters] = {
+		vivante::Backend::CPU, vivante::Backend::OpenCV, vivante::Backend::OpenCL, vivante::Backend::OpenCVFused, vivante::Backend::Auto
+	};
+	// Auto runs its own instance of every other backend : it is only created once selected
+	const int autoIndex = (int)FilterContext::Auto_Sobel;
+	std::unique_ptr<vivante::Filter> filters[numFilters];
+	for (int i = 0; i < numFilters; ++i) {
+		if (i == autoIndex) {
+			continue;
+		}
+		try {
+			filters[i] = createFilter(backends[i], videoWidth_, videoHeight_, options);
+		}
+		catch (const std::exception& e) {
+			fprintf(stderr, "Error(%s Setup) : %s \n", vivante::backendName(backends[i]), e.what());
+			exit(EXIT_FAILURE);
+		}
 	}
-	catch (const std::exception& e) {
-		fprintf(stderr, "Error(OpenCL Setup) : %s \n", e.what());
-		exit(EXIT_FAILURE);
+	printf("Filter setup finished (%s). \n", vivante::operatorName(options.op));
+	if (options.blurSigma > 0.0f) {
+		printf("Gaussian pre-filter, sigma %.2f \n", options.blurSigma);
+	}
+
+	std::unique_ptr<FrameRingProducer> ring;
+	if (shmName) {
+		try {
+			ring.reset(new FrameRingProducer(shmName, videoWidth_, videoHeight_));
+		}
+		catch (const std::exception& e) {
+			fprintf(stderr, "Error(Shared memory) : %s \n", e.what());
+			exit(EXIT_FAILURE);
+		}
+		printf("Publishing edge frames to %s \n", shmName);
 	}
-	printf("OpenCL Context setup finished. \n");
 
-	printf("Press (1/2/3/4) to switch between filters \n");
-	printf("1: None, 2:CPU, 3:OpenCV, 4:OpenCL \n");
+	// Cumulative for the whole run, unlike the on-screen timers which restart with the video
+	Metrics metrics;
+	std::unique_ptr<MetricsExporter> exporter;
+	if (metricsPort > 0 || metricsJson) {
+		try {
+			exporter.reset(new MetricsExporter(metrics, metricsPort, metricsJson, metricsInterval));
+		}
+		catch (const std::exception& e) {
+			fprintf(stderr, "Error(Metrics) : %s \n", e.what());
+			exit(EXIT_FAILURE);
+		}
+		if (metricsPort > 0) {
+			printf("Serving metrics on http://127.0.0.1:%d/metrics \n", metricsPort);
+		}
+	}
+
+	printf("Press (1/2/3/4/5/6) to switch between filters \n");
+	printf("1: None, 2:CPU, 3:OpenCV, 4:OpenCL, 5:OpenCV Fused, 6:Auto \n");
 	printf("Press (9/0) to make font smaller/larger \n");
 	printf("Press (-) to loop/unloop video \n");
-	UMat frame;
+	printf("Press (c) to detect edges on the colour channels instead of the grey image (Sobel only) \n");
+	Mat frame;
+	Mat gray;
+	Mat edges(videoHeight_, videoWidth_, CV_8UC1);
 	FilterContext filterContext = FilterContext::None;
-	Timer timer[3];
+	Timer timer[numFilters];
 	while (true) {
+		StageClock clock;
+		double frameTime_ms = 0.0;
+
 		if (readFrame(videoStream, frame) == false) {
 			if (gIsLooping) {
-				for (int i = 0; i < 3; ++i) {
+				for (int i = 0; i < numFilters; ++i) {
 					timer[i].reset();
 				}
 				videoStream.set(CAP_PROP_POS_MSEC, 0.0);
+				// Live counts must stay flat from one loop to the next
+				printf("OpenCL resources : %s \n", vivante::resourceReport().c_str());
 				continue;
 			}
 			break;
 		}
-
-		if (filterContext != FilterContext::None) {
-			cvtColor(frame, frame, COLOR_BGR2GRAY);
-		}
+		frameTime_ms += clock.lap();
+		metrics.stage(Stage::Read, frameTime_ms);
 
 		// do edge detection
-		switch ((int)filterContext) {
-		case (int)FilterContext::Simple_Sobel:	
-			simple_sobel(frame, videoWidth_, videoHeight_, timer[(int)FilterContext::Simple_Sobel]);
-			break;
-		case (int)FilterContext::OpenCV_Sobel:	
-			opencv_sobel(frame, timer[(int)FilterContext::OpenCV_Sobel]); 
-			break;
-		case (int)FilterContext::OpenCL_Sobel:	
-			clContext->sobel(frame, timer[(int)FilterContext::OpenCL_Sobel]);
-			break;
+		Mat* output = &frame;
+		Mat slot;
+		Mat slotOverlay;
+		vivante::Filter* publishing = nullptr;
+		double filterTime_ms = 0.0;
+		if (filterContext != FilterContext::None && filters[(int)filterContext]) {
+			int index = (int)filterContext;
+
+			// With a ring, the filter renders straight into the shared slot
+			Mat* target = &edges;
+			if (ring) {
+				slot = Mat(videoHeight_, videoWidth_, CV_8UC1, ring->beginFrame(), ring->stride());
+				target = &slot;
+			}
+
+			if (gIsColor) {
+				filterTime_ms = filters[index]->processColor(toConstColorPlane(frame), toPlane(*target));
+			}
+			else {
+				cvtColor(frame, gray, COLOR_BGR2GRAY);
+				double convertTime_ms = clock.lap();
+				frameTime_ms += convertTime_ms;
+				metrics.stage(Stage::Convert, convertTime_ms);
+
+				filterTime_ms = filters[index]->process(toConstPlane(gray), toPlane(*target));
+			}
+			timer[index].update(filterTime_ms);
+			output = target;
+
+			double stageTime_ms = clock.lap();
+			frameTime_ms += stageTime_ms;
+			metrics.stage(Stage::Filter, stageTime_ms);
+			metrics.frame(filters[index]->activeBackend(), filterTime_ms);
+
+			// Consumers do not see the slot before it is published : keep the rows under
+			// the overlay and put them back after display
+			if (ring) {
+				slot.rowRange(0, overlayRows(videoHeight_)).copyTo(slotOverlay);
+				publishing = filters[index].get();
+			}
 		}
 		
-		printLog(frame, filterContext, timer);
-		cv::imshow("Video player", frame);
+		printLog(*output, filterContext, timer);
+		cv::imshow("Video player", *output);
+
+		double displayTime_ms = clock.lap();
+		frameTime_ms += displayTime_ms;
+		metrics.stage(Stage::Display, displayTime_ms);
+
+		if (publishing) {
+			Mat slotTop = slot.rowRange(0, slotOverlay.rows);
+			slotOverlay.copyTo(slotTop);
+			ring->publish(frameMeta(*publishing, filterTime_ms));
+
+			double publishTime_ms = clock.lap();
+			frameTime_ms += publishTime_ms;
+			metrics.stage(Stage::Publish, publishTime_ms);
+		}
+
+		// Work alone took longer than a frame : a real-time sink would have dropped it
+		if (frameTime_ms > refreshTime_ms) {
+			metrics.dropped();
+		}
 
 		int keyCode = waitKey(refreshTime_ms);
 		if (keyCode == KEY_ESCAPE) {
@@ -188,6 +581,18 @@ int main(int argc, char* argv[])
 		case KEY_2: filterContext = FilterContext::Simple_Sobel;	 break;
 		case KEY_3: filterContext = FilterContext::OpenCV_Sobel;	 break;
 		case KEY_4: filterContext = FilterContext::OpenCL_Sobel;	 break;
+		case KEY_5: filterContext = FilterContext::Fused_Sobel;		 break;
+		case KEY_6:
+			if (!filters[autoIndex]) {
+				try {
+					filters[autoIndex] = createFilter(backends[autoIndex], videoWidth_, videoHeight_, options);
+				}
+				catch (const std::exception& e) {
+					fprintf(stderr, "Error(%s Setup) : %s \n", vivante::backendName(backends[autoIndex]), e.what());
+				}
+			}
+			filterContext = FilterContext::Auto_Sobel;
+			break;
 
 		case KEY_0: gFontSize_ = std::min(gFontSize_ + 0.25f, 5.0f); break;
 		case KEY_9: gFontSize_ = std::max(0.0f, gFontSize_ - 0.25f);  break;
@@ -196,11 +601,29 @@ int main(int argc, char* argv[])
 			gIsLooping = !gIsLooping;
 			printf("Video Loop : %s \n", gIsLooping ? "TRUE" : "FALSE");
 			break;
+
+		case KEY_C:
+			if (options.op != vivante::Operator::Sobel) {
+				printf("Colour edges are only available for Sobel \n");
+				break;
+			}
+			gIsColor = !gIsColor;
+			// Grey and colour frames do not cost the same, start the statistics over
+			for (int i = 0; i < numFilters; ++i) {
+				timer[i].reset();
+			}
+			printf("Colour edges : %s \n", gIsColor ? "TRUE" : "FALSE");
+			break;
 		}
 	}
 
-	delete clContext;
 	destroyAllWindows();
 
+	// Everything must be released once the filters are gone
+	for (int i = 0; i < numFilters; ++i) {
+		filters[i].reset();
+	}
+	printf("OpenCL resources : %s \n", vivante::resourceReport().c_str());
+
 	return 0;
 }
\ No newline at end of file
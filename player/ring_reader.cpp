@@ -0,0 +1,73 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include "FrameRing.h"
+
+// Minimal frame ring consumer : attaches to a running player, reads every
+// edge frame in place and prints its metadata together with the share of
+// edge pixels. Intentionally slow consumers can be simulated with a delay
+// to see frames being dropped instead of stalling the player.
+//
+// Usage : ./ring_reader /vivante [delay_ms]
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage : ./ring_reader name [delay_ms] \n");
+		return EXIT_FAILURE;
+	}
+	int delay_ms = argc > 2 ? atoi(argv[2]) : 0;
+
+	try {
+		FrameRingConsumer ring(argv[1]);
+		printf("Attached to %s (%dx%d, %d slots) \n", argv[1], ring.width(), ring.height(), ring.slotCount());
+
+		FrameView frame;
+		uint64_t frames = 0;
+		uint64_t torn = 0;
+		while (true) {
+			FrameRingConsumer::Status status = ring.next(frame, 1000);
+			if (status == FrameRingConsumer::Status::Closed) {
+				break;
+			}
+			if (status == FrameRingConsumer::Status::Timeout) {
+				continue;
+			}
+
+			size_t edgePixels = 0;
+			for (int y = 0; y < frame.height; ++y) {
+				const unsigned char* row = frame.data + y * frame.stride;
+				for (int x = 0; x < frame.width; ++x) {
+					edgePixels += row[x] > 64;
+				}
+			}
+			if (delay_ms > 0) {
+				usleep(delay_ms * 1000);
+			}
+
+			// The producer lapped us while we were counting
+			if (ring.stillValid(frame) == false) {
+				++torn;
+				continue;
+			}
+
+			++frames;
+			uint64_t latency_us = (framering::monotonicNs() - frame.meta.timestampNs) / 1000;
+			printf("frame %llu : %s %.2lf ms, edges %.1lf%%, latency %llu us, dropped %llu \n",
+				(unsigned long long)frame.meta.index, frame.meta.backendName, frame.meta.filterTime_ms,
+				100.0 * edgePixels / ((double)frame.width * frame.height), (unsigned long long)latency_us,
+				(unsigned long long)ring.droppedFrames());
+		}
+
+		printf("Producer closed : %llu frames read, %llu dropped, %llu overwritten while reading \n",
+			(unsigned long long)frames, (unsigned long long)ring.droppedFrames(), (unsigned long long)torn);
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "Error : %s \n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,658 @@
+#include <cstdarg>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "vivante.h"
+#include "gaussian.h"
+#include "FrameRing.h"
+#include "SyntheticFrames.h"
+
+// Self-check : runs synthetic frames (SyntheticFrames.h) through every backend this
+// machine can create, compares the outputs, and runs the shared memory frame ring
+// through several wrap-arounds. Prints one line per check and exits with 1 if any fails.
+// Backends that can not be created (no OpenCL device) are listed as skipped.
+//
+// Usage : ./self_check [--cl-dir path]
+//
+// The backends do not compute the same magnitude, so each comparison states its tolerance :
+//   sobel  CPU is L2 with zero borders, OpenCL L1 with replicated borders and OpenCV
+//          h = (sat|gx| + sat|gy|) / 2 with reflected borders. Away from the 1 pixel
+//          border and below 255 the norms bound each other : L2 <= 2h + 1 and
+//          2h <= sqrt(2) (L2 + 1) + 1 for CPU, |L1 - 2h| <= 1 for OpenCL.
+//          OpenCV Fused must equal OpenCV.
+//   canny  OpenCL must equal CPU. 4 pixels away from the border, at least 95% of their
+//          edges lie within 2 pixels of an OpenCV edge, and at least 75% of the OpenCV
+//          edges lie within 2 pixels of one of theirs. Both blur with the 5x5 / 159
+//          kernel, wider than OpenCV's, and keep fewer weak edges (measured on these
+//          frames : 98% and 79%).
+//   blur   gaussian::BoxBlur (CPU, OpenCV and OpenCV Fused pre-filter) against
+//          cv::GaussianBlur with a 4 sigma kernel and replicated borders : over the
+//          whole frame, |error| <= 5 and mean |error| <= 1.1 (gaussian.h).
+//          Sobel of blurred frames keeps the sobel bounds; OpenCL blurs on the device
+//          and may round up to 0.1% of the pixels the other way.
+//   stats  Filter::analyze gives the same EdgeStats on every backend.
+//   tiles  OpenCL on 128 pixel tiles equals OpenCL on whole frames.
+//   auto   every frame equals the output of the backend Auto ran it on.
+//   ring   every frame of several wrap-arounds arrives intact, a consumer that falls
+//          behind jumps to the newest frame and reports the skipped ones, and an
+//          overwritten slot is detected by stillValid(). A ring that hangs fails after
+//          RING_TIMEOUT_S seconds.
+
+struct Size
+{
+	int width;
+	int height;
+};
+
+// Odd sizes on purpose : partial SIMD blocks, partial OpenCL work-groups and tiles
+const Size SIZES[] = { { 640, 480 }, { 333, 97 } };
+const SyntheticPattern PATTERNS[] = { SyntheticPattern::Shapes, SyntheticPattern::Noise, SyntheticPattern::Gradient };
+const int64_t FRAME_INDICES[] = { 0, 17 };
+const float BLUR_SIGMAS[] = { 1.0f, 2.5f, 6.0f };
+const float PREFILTER_SIGMA = 2.5f;
+// A ring that stops handing out frames would otherwise hang the check
+const unsigned RING_TIMEOUT_S = 30;
+const int TILE_SIZE = 128;
+const int AUTO_FRAMES = 40;
+
+// Result of one comparison on one frame. badness orders the outcomes of a check,
+// the worst one is reported.
+struct Outcome
+{
+	bool pass;
+	double badness;
+	std::string detail;
+};
+
+std::string format(const char* fmt, ...)
+{
+	char text[256];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(text, sizeof(text), fmt, args);
+	va_end(args);
+	return text;
+}
+
+class Report
+{
+public:
+	void add(const std::string& check, const Outcome& outcome)
+	{
+		Tally& tally = find(check);
+		++tally.runs;
+		if (outcome.pass == false) {
+			++tally.failed;
+		}
+		// A failure always outranks a pass
+		bool worse = tally.runs == 1 || (outcome.pass == false && tally.worstPassed) ||
+			(outcome.pass == tally.worstPassed && outcome.badness > tally.worst);
+		if (worse) {
+			tally.worst = outcome.badness;
+			tally.worstPassed = outcome.pass;
+			tally.detail = outcome.detail;
+		}
+	}
+
+	void skip(const std::string& check, const std::string& reason)
+	{
+		Tally& tally = find(check);
+		if (tally.skipped.empty()) {
+			tally.skipped = reason;
+		}
+	}
+
+	// Prints every check and returns the number of failed ones
+	int print(int& skipped) const
+	{
+		int failed = 0;
+		skipped = 0;
+		for (const auto& entry : tallies_) {
+			const Tally& tally = entry.second;
+			if (tally.runs == 0) {
+				++skipped;
+				printf("skip  %-48s %s \n", entry.first.c_str(), tally.skipped.c_str());
+				continue;
+			}
+			if (tally.failed > 0) {
+				++failed;
+				printf("FAIL  %-48s %d of %d failed, worst : %s \n", entry.first.c_str(), tally.failed, tally.runs, tally.detail.c_str());
+			}
+			else {
+				printf("ok    %-48s worst of %d : %s \n", entry.first.c_str(), tally.runs, tally.detail.c_str());
+			}
+		}
+		return failed;
+	}
+
+private:
+	struct Tally
+	{
+		int runs = 0;
+		int failed = 0;
+		double worst = 0.0;
+		bool worstPassed = true;
+		std::string detail;
+		std::string skipped;
+	};
+
+	Tally& find(const std::string& check)
+	{
+		for (auto& entry : tallies_) {
+			if (entry.first == check) {
+				return entry.second;
+			}
+		}
+		tallies_.push_back(std::make_pair(check, Tally()));
+		return tallies_.back().second;
+	}
+
+	// In the order the checks first ran
+	std::vector<std::pair<std::string, Tally>> tallies_;
+};
+
+//------------------------------------------------------------------
+// Frames and filters
+
+// Synthetic frame in a plane wider than the image, so that every backend sees a stride
+cv::Mat renderFrame(const SyntheticSource& source, int64_t index)
+{
+	cv::Mat buffer(source.height(), source.width() + 16, CV_8UC1);
+	cv::Mat frame = buffer.colRange(0, source.width());
+	source.render(index, frame.data, frame.step);
+	return frame;
+}
+
+vivante::ConstPlane toConstPlane(const cv::Mat& mat)
+{
+	return { mat.data, mat.cols, mat.rows, mat.step };
+}
+
+vivante::Plane toPlane(cv::Mat& mat)
+{
+	return { mat.data, mat.cols, mat.rows, mat.step };
+}
+
+// The filter, or null with the reason when this machine or backend can not run options
+std::unique_ptr<vivante::Filter> createFilter(vivante::Backend backend, const Size& size, const vivante::Options& options, std::string& reason)
+{
+	try {
+		return std::unique_ptr<vivante::Filter>(new vivante::Filter(backend, size.width, size.height, options));
+	}
+	catch (const std::exception& e) {
+		reason = e.what();
+		return nullptr;
+	}
+}
+
+cv::Mat runFilter(vivante::Filter& filter, const cv::Mat& frame)
+{
+	cv::Mat buffer(frame.rows, frame.cols + 8, CV_8UC1);
+	cv::Mat edges = buffer.colRange(0, frame.cols);
+	filter.process(toConstPlane(frame), toPlane(edges));
+	return edges;
+}
+
+//------------------------------------------------------------------
+// Comparisons, see the top of the file for the tolerances
+
+Outcome identical(const cv::Mat& output, const cv::Mat& reference)
+{
+	cv::Mat difference;
+	cv::absdiff(output, reference, difference);
+	int count = cv::countNonZero(difference);
+	double largest = 0.0;
+	cv::minMaxLoc(difference, nullptr, &largest);
+
+	return { count == 0, (double)count, format("%d of %d pixels differ, by up to %.0f", count, output.rows * output.cols, largest) };
+}
+
+Outcome sameStats(const vivante::EdgeStats& stats, const vivante::EdgeStats& reference)
+{
+	int fields = 0;
+	fields += stats.edgePixels != reference.edgePixels;
+	fields += stats.meanGradient != reference.meanGradient;
+	fields += memcmp(stats.regionDensity, reference.regionDensity, sizeof(stats.regionDensity)) != 0;
+	fields += memcmp(stats.orientation, reference.orientation, sizeof(stats.orientation)) != 0;
+
+	return { fields == 0, (double)fields, format("%d fields differ, %u edge pixels against %u", fields, stats.edgePixels, reference.edgePixels) };
+}
+
+enum class Norm
+{
+	L1,
+	L2
+};
+
+// magnitude : CPU (L2) or OpenCL (L1), halfSum : OpenCV. allowed : fraction of pixels that may fall outside
+Outcome sobelBounds(const cv::Mat& magnitude, Norm norm, const cv::Mat& halfSum, double allowed)
+{
+	long compared = 0;
+	long outside = 0;
+	for (int y = 1; y < magnitude.rows - 1; ++y) {
+		const unsigned char* m = magnitude.ptr<unsigned char>(y);
+		const unsigned char* h = halfSum.ptr<unsigned char>(y);
+		for (int x = 1; x < magnitude.cols - 1; ++x) {
+			if (m[x] == 255) {
+				continue;
+			}
+			int twice = 2 * h[x];
+			bool inside = norm == Norm::L1 ? std::abs(m[x] - twice) <= 1 :
+				(m[x] <= twice + 1 && twice <= std::sqrt(2.0) * (m[x] + 1) + 1);
+			outside += inside ? 0 : 1;
+			++compared;
+		}
+	}
+
+	double fraction = compared > 0 ? (double)outside / compared : 0.0;
+	return { fraction <= allowed, fraction, format("%ld of %ld pixels outside the bounds", outside, compared) };
+}
+
+Outcome cannyAgreement(const cv::Mat& edges, const cv::Mat& reference)
+{
+	const int MARGIN = 4;
+	const int REACH = 2;
+	const double MIN_PRECISION = 0.95;
+	const double MIN_RECALL = 0.75;
+
+	cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(2 * REACH + 1, 2 * REACH + 1));
+	cv::Mat nearReference, nearCandidate;
+	cv::dilate(reference, nearReference, kernel);
+	cv::dilate(edges, nearCandidate, kernel);
+
+	long strong = 0, strongNear = 0, referenceEdges = 0, referenceNear = 0;
+	for (int y = MARGIN; y < edges.rows - MARGIN; ++y) {
+		const unsigned char* e = edges.ptr<unsigned char>(y);
+		const unsigned char* r = reference.ptr<unsigned char>(y);
+		const unsigned char* nr = nearReference.ptr<unsigned char>(y);
+		const unsigned char* nc = nearCandidate.ptr<unsigned char>(y);
+		for (int x = MARGIN; x < edges.cols - MARGIN; ++x) {
+			if (e[x] == 255) {
+				++strong;
+				strongNear += nr[x] != 0;
+			}
+			if (r[x] != 0) {
+				++referenceEdges;
+				referenceNear += nc[x] != 0;
+			}
+		}
+	}
+
+	double precision = strong > 0 ? (double)strongNear / strong : 1.0;
+	double recall = referenceEdges > 0 ? (double)referenceNear / referenceEdges : 1.0;
+	double margin = std::min(precision - MIN_PRECISION, recall - MIN_RECALL);
+	return { margin >= 0.0, -margin, format("precision %.3f (%ld edges), recall %.3f (%ld OpenCV edges)", precision, strong, recall, referenceEdges) };
+}
+
+Outcome blurError(const cv::Mat& frame, float sigma)
+{
+	const double MAX_ERROR = 5.0;
+	const double MAX_MEAN_ERROR = 1.1;
+
+	cv::Mat boxed(frame.rows, frame.cols, CV_8UC1);
+	gaussian::BoxBlur blur(sigma, frame.cols, frame.rows);
+	blur.apply(frame.data, frame.step, boxed.data, boxed.step);
+
+	int kernelSize = 2 * (int)std::ceil(4.0f * sigma) + 1;
+	cv::Mat exact;
+	cv::GaussianBlur(frame, exact, cv::Size(kernelSize, kernelSize), sigma, sigma, cv::BORDER_REPLICATE);
+
+	cv::Mat difference;
+	cv::absdiff(boxed, exact, difference);
+	double largest = 0.0;
+	cv::minMaxLoc(difference, nullptr, &largest);
+	double mean = cv::mean(difference)[0];
+
+	bool pass = largest <= MAX_ERROR && mean <= MAX_MEAN_ERROR;
+	return { pass, std::max(largest / MAX_ERROR, mean / MAX_MEAN_ERROR), format("max |error| %.0f, mean %.3f", largest, mean) };
+}
+
+//------------------------------------------------------------------
+// Checks
+
+std::string frameName(const Size& size, SyntheticPattern pattern, int64_t index)
+{
+	return format("%dx%d %s #%lld", size.width, size.height, patternName(pattern), (long long)index);
+}
+
+// Sobel (optionally on blurred frames) and Canny on CPU, OpenCV Fused and OpenCL against OpenCV,
+// plus OpenCL Canny against CPU Canny and OpenCL on tiles against OpenCL on whole frames
+void checkOperator(Report& report, const char* check, const vivante::Options& options, const Size& size)
+{
+	const vivante::Backend compared[] = { vivante::Backend::CPU, vivante::Backend::OpenCVFused, vivante::Backend::OpenCL };
+	const bool canny = options.op == vivante::Operator::Canny;
+	const bool blurred = options.blurSigma > 0.0f;
+
+	std::string reason;
+	std::unique_ptr<vivante::Filter> reference = createFilter(vivante::Backend::OpenCV, size, options, reason);
+	if (!reference) {
+		report.skip(std::string(check) + " (OpenCV)", reason);
+		return;
+	}
+
+	std::vector<std::unique_ptr<vivante::Filter>> filters;
+	for (vivante::Backend backend : compared) {
+		filters.push_back(createFilter(backend, size, options, reason));
+		if (!filters.back()) {
+			report.skip(std::string(check) + " " + vivante::backendName(backend) + " vs OpenCV", reason);
+			if (canny && backend == vivante::Backend::OpenCL) {
+				report.skip(std::string(check) + " OpenCL vs CPU", reason);
+			}
+		}
+	}
+
+	// Tiles keep the host pre-filter, so only compare them without blur
+	std::unique_ptr<vivante::Filter> tiled;
+	vivante::Options tileOptions = options;
+	tileOptions.clMaxTileSize = TILE_SIZE;
+	if (!blurred) {
+		tiled = createFilter(vivante::Backend::OpenCL, size, tileOptions, reason);
+		if (!tiled) {
+			report.skip(std::string(check) + " OpenCL tiles vs whole frames", reason);
+		}
+	}
+
+	for (SyntheticPattern pattern : PATTERNS) {
+		SyntheticSource source(pattern, size.width, size.height);
+		for (int64_t index : FRAME_INDICES) {
+			cv::Mat frame = renderFrame(source, index);
+			cv::Mat expected = runFilter(*reference, frame);
+			const std::string where = ", " + frameName(size, pattern, index);
+			cv::Mat cpuOutput;
+
+			for (size_t i = 0; i < filters.size(); ++i) {
+				if (!filters[i]) {
+					continue;
+				}
+				vivante::Backend backend = compared[i];
+				cv::Mat output = runFilter(*filters[i], frame);
+				Outcome outcome;
+				if (canny) {
+					outcome = cannyAgreement(output, expected);
+				}
+				else if (backend == vivante::Backend::OpenCVFused) {
+					outcome = identical(output, expected);
+				}
+				else {
+					bool deviceBlur = blurred && backend == vivante::Backend::OpenCL;
+					outcome = sobelBounds(output, backend == vivante::Backend::CPU ? Norm::L2 : Norm::L1, expected, deviceBlur ? 0.001 : 0.0);
+				}
+				outcome.detail += where;
+				report.add(std::string(check) + " " + vivante::backendName(backend) + " vs OpenCV", outcome);
+
+				if (canny && backend == vivante::Backend::CPU) {
+					cpuOutput = output;
+				}
+				if (canny && backend == vivante::Backend::OpenCL && !cpuOutput.empty()) {
+					Outcome outcome = identical(output, cpuOutput);
+					outcome.detail += where;
+					report.add(std::string(check) + " OpenCL vs CPU", outcome);
+				}
+
+				if (tiled && backend == vivante::Backend::OpenCL) {
+					Outcome outcome = identical(runFilter(*tiled, frame), output);
+					outcome.detail += where;
+					report.add(std::string(check) + " OpenCL tiles vs whole frames", outcome);
+				}
+			}
+		}
+	}
+}
+
+void checkBlur(Report& report, const Size& size)
+{
+	for (float sigma : BLUR_SIGMAS) {
+		for (SyntheticPattern pattern : PATTERNS) {
+			SyntheticSource source(pattern, size.width, size.height);
+			for (int64_t index : FRAME_INDICES) {
+				Outcome outcome = blurError(renderFrame(source, index), sigma);
+				outcome.detail += ", " + frameName(size, pattern, index);
+				report.add(format("blur sigma %g BoxBlur vs cv::GaussianBlur", sigma), outcome);
+			}
+		}
+	}
+}
+
+void checkStats(Report& report, const vivante::Options& options, const Size& size)
+{
+	const vivante::Backend backends[] = { vivante::Backend::OpenCV, vivante::Backend::OpenCVFused, vivante::Backend::OpenCL, vivante::Backend::OpenCL };
+
+	std::string reason;
+	std::unique_ptr<vivante::Filter> reference = createFilter(vivante::Backend::CPU, size, options, reason);
+	std::vector<std::unique_ptr<vivante::Filter>> filters;
+	std::vector<std::string> checks;
+	for (vivante::Backend backend : backends) {
+		// The second OpenCL filter runs on tiles
+		vivante::Options filterOptions = options;
+		bool tiles = backend == vivante::Backend::OpenCL && filters.size() == 3;
+		filterOptions.clMaxTileSize = tiles ? TILE_SIZE : 0;
+
+		checks.push_back(std::string("stats ") + vivante::backendName(backend) + (tiles ? " tiles" : "") + " vs CPU");
+		filters.push_back(createFilter(backend, size, filterOptions, reason));
+		if (!filters.back()) {
+			report.skip(checks.back(), reason);
+		}
+	}
+
+	for (SyntheticPattern pattern : PATTERNS) {
+		SyntheticSource source(pattern, size.width, size.height);
+		for (int64_t index : FRAME_INDICES) {
+			cv::Mat frame = renderFrame(source, index);
+			vivante::EdgeStats expected;
+			reference->analyze(toConstPlane(frame), expected);
+
+			for (size_t i = 0; i < filters.size(); ++i) {
+				if (!filters[i]) {
+					continue;
+				}
+				vivante::EdgeStats stats;
+				filters[i]->analyze(toConstPlane(frame), stats);
+				Outcome outcome = sameStats(stats, expected);
+				outcome.detail += ", " + frameName(size, pattern, index);
+				report.add(checks[i], outcome);
+			}
+		}
+	}
+}
+
+// Feeds Auto a changing stream of frames through its benchmark and checks every output
+// against the backend that produced it
+void checkAuto(Report& report, const char* check, const vivante::Options& options, const Size& size)
+{
+	std::string reason;
+	std::unique_ptr<vivante::Filter> automatic = createFilter(vivante::Backend::Auto, size, options, reason);
+	if (!automatic) {
+		report.skip(check, reason);
+		return;
+	}
+
+	// Created on first use, Auto only runs what could be created anyway
+	std::unique_ptr<vivante::Filter> references[(int)vivante::Backend::Auto];
+	SyntheticSource source(SyntheticPattern::Shapes, size.width, size.height);
+	for (int i = 0; i < AUTO_FRAMES; ++i) {
+		cv::Mat frame = renderFrame(source, i);
+		cv::Mat output = runFilter(*automatic, frame);
+
+		vivante::Backend active = automatic->activeBackend();
+		std::unique_ptr<vivante::Filter>& reference = references[(int)active];
+		if (!reference) {
+			reference = createFilter(active, size, options, reason);
+		}
+		Outcome outcome = reference ? identical(output, runFilter(*reference, frame)) : Outcome{ false, 1.0, reason };
+		outcome.detail += std::string(", ") + vivante::backendName(active) + ", " + frameName(size, SyntheticPattern::Shapes, i);
+		report.add(check, outcome);
+	}
+}
+
+// Name of the ring under test, removed by ringTimedOut()
+char ringName[64];
+
+void ringTimedOut(int)
+{
+	shm_unlink(ringName);
+	static const char message[] = "FAIL  ring                                             did not finish, timed out \n";
+	ssize_t written = write(STDOUT_FILENO, message, sizeof(message) - 1);
+	(void)written;
+	_exit(EXIT_FAILURE);
+}
+
+void checkRing(Report& report)
+{
+	const int WIDTH = 97;
+	const int HEIGHT = 61;
+	const int SLOTS = 4;
+	const std::string name = format("/vivante_self_check_%d", (int)getpid());
+	snprintf(ringName, sizeof(ringName), "%s", name.c_str());
+	SyntheticSource source(SyntheticPattern::Noise, WIDTH, HEIGHT);
+	std::vector<unsigned char> expected((size_t)WIDTH * HEIGHT);
+
+	// Publishes frame index, rendered straight into the slot
+	auto publish = [&](FrameRingProducer& producer, int64_t index) {
+		source.render(index, producer.beginFrame(), producer.stride());
+		FrameMeta meta = {};
+		producer.publish(meta);
+	};
+	// Reads the next frame and returns what is wrong with it, empty if nothing
+	auto receive = [&](FrameRingConsumer& consumer, int64_t index, FrameView& view) -> std::string {
+		if (consumer.next(view, 1000) != FrameRingConsumer::Status::Frame) {
+			return format("no frame %lld", (long long)index);
+		}
+		if (view.meta.index != (uint64_t)index) {
+			return format("frame %llu instead of %lld", (unsigned long long)view.meta.index, (long long)index);
+		}
+		source.render(index, &expected[0], WIDTH);
+		for (int y = 0; y < HEIGHT; ++y) {
+			if (memcmp(view.data + view.stride * y, &expected[(size_t)WIDTH * y], WIDTH) != 0) {
+				return format("frame %lld has wrong pixels in row %d", (long long)index, y);
+			}
+		}
+		if (consumer.stillValid(view) == false) {
+			return format("frame %lld overwritten while nothing was published", (long long)index);
+		}
+		return "";
+	};
+	auto add = [&](const char* check, const std::string& error, const std::string& detail) {
+		report.add(check, { error.empty(), error.empty() ? 0.0 : 1.0, error.empty() ? detail : error });
+	};
+
+	try {
+		std::unique_ptr<FrameRingProducer> producer(new FrameRingProducer(name, WIDTH, HEIGHT, SLOTS));
+		FrameRingConsumer consumer(name);
+		FrameView view;
+		int64_t index = 0;
+
+		// Lockstep through three wrap-arounds
+		std::string error;
+		for (; index < 3 * SLOTS + 1 && error.empty(); ++index) {
+			publish(*producer, index);
+			error = receive(consumer, index, view);
+		}
+		if (error.empty() && consumer.droppedFrames() != 0) {
+			error = format("%llu frames reported dropped", (unsigned long long)consumer.droppedFrames());
+		}
+		add("ring wrap-around", error, format("%lld frames through %d slots", (long long)index, SLOTS));
+
+		// Two rings behind : the consumer jumps to the newest frame
+		const int64_t behind = 2 * SLOTS + 1;
+		for (int i = 0; i < behind; ++i) {
+			publish(*producer, index++);
+		}
+		error = receive(consumer, index - 1, view);
+		if (error.empty() && consumer.droppedFrames() != (uint64_t)(behind - 1)) {
+			error = format("%llu frames reported dropped instead of %lld", (unsigned long long)consumer.droppedFrames(), (long long)(behind - 1));
+		}
+		add("ring consumer falling behind", error, format("%llu frames skipped", (unsigned long long)consumer.droppedFrames()));
+
+		// The slot of the frame being read is reused SLOTS frames later
+		for (int i = 0; i < SLOTS - 1 && error.empty(); ++i) {
+			publish(*producer, index++);
+			if (consumer.stillValid(view) == false) {
+				error = format("frame reported overwritten after %d frames", i + 1);
+			}
+		}
+		publish(*producer, index++);
+		if (error.empty() && consumer.stillValid(view)) {
+			error = "overwritten frame still reported valid";
+		}
+		add("ring overwrite detection", error, format("slot reused after %d frames", SLOTS));
+
+		// Drain, then the producer goes away
+		FrameRingConsumer::Status status;
+		while ((status = consumer.next(view, 0)) == FrameRingConsumer::Status::Frame) {
+		}
+		error = status == FrameRingConsumer::Status::Timeout ? "" : "no timeout on an empty ring";
+		producer.reset();
+		if (error.empty() && consumer.next(view, 1000) != FrameRingConsumer::Status::Closed) {
+			error = "ring not reported closed";
+		}
+		add("ring timeout and close", error, "timeout, then closed");
+	}
+	catch (const std::exception& e) {
+		add("ring wrap-around", e.what(), "");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	vivante::Options options;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--cl-dir") == 0 && i + 1 < argc) {
+			options.clSourceDir = argv[++i];
+		}
+		else {
+			fprintf(stderr, "Usage : ./self_check [--cl-dir path] \n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	Report report;
+	for (const Size& size : SIZES) {
+		vivante::Options sobel = options;
+		checkOperator(report, "sobel", sobel, size);
+
+		vivante::Options blurred = options;
+		blurred.blurSigma = PREFILTER_SIGMA;
+		checkOperator(report, "sobel on blurred frames", blurred, size);
+
+		vivante::Options canny = options;
+		canny.op = vivante::Operator::Canny;
+		checkOperator(report, "canny", canny, size);
+
+		checkBlur(report, size);
+		checkStats(report, sobel, size);
+	}
+
+	vivante::Options canny = options;
+	canny.op = vivante::Operator::Canny;
+	checkAuto(report, "auto sobel", options, SIZES[0]);
+	checkAuto(report, "auto canny", canny, SIZES[0]);
+
+	signal(SIGALRM, ringTimedOut);
+	alarm(RING_TIMEOUT_S);
+	checkRing(report);
+	alarm(0);
+
+	// Every Filter is gone by now
+	vivante::ResourceUsage usage = vivante::resourceUsage();
+	report.add("opencl objects released", { usage.clObjects == 0, (double)usage.clObjects, vivante::resourceReport() });
+
+	int skipped = 0;
+	int failed = report.print(skipped);
+	printf("%s, %d skipped \n", failed == 0 ? "All checks passed" : format("%d checks failed", failed).c_str(), skipped);
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,7 +1,12 @@
 #pragma once 
 
 #include <stdlib.h>
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "stencil.h"
 
 typedef unsigned char uchar;
 typedef uchar pixel;
@@ -16,59 +21,30 @@ typedef union rgb_pixel {
 //WS :
 //  union rgb_pixel is not necessary for now
 
-inline void sobel_operator(uchar* op, uchar* np, int width, int height)
+// Zero padded borders and an L2 magnitude, same output as the original scalar loops
+typedef stencil::Gradient<stencil::Taps<1, 2, 1>, stencil::Taps<-1, 0, 1>, stencil::MagnitudeL2> sobel_l2_op;
+typedef stencil::Dense<5, stencil::Taps<
+    2, 4, 5, 4, 2,
+    4, 9,12, 9, 4,
+    5,12,15,12, 5,
+    4, 9,12, 9, 4,
+    2, 4, 5, 4, 2>> gaussian_159_kernel;
+typedef stencil::Operator<stencil::Normalize<159>, gaussian_159_kernel> gaussian_159_op;
+typedef stencil::Operator<stencil::NormalizeRound<159>, gaussian_159_kernel> canny_blur_op;
+
+inline void sobel_operator(const uchar* op, size_t opStride, uchar* np, size_t npStride, int width, int height)
 {
-    const int filter[] = { 1, 2, 1 };
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-
-            int sum_x = 0, sum_y = 0;
+    stencil::apply<sobel_l2_op, stencil::BorderZero>(op, opStride, np, npStride, width, height);
+}
 
-            for (int row = -1; row < 2; row++) {
-                for (int col = -1; col < 2; col++) {
-                    if (x + row >= 0 && x + row < width && y + col >= 0 && y + col < height) {
-                        sum_x += filter[row + 1] * col * op[width * (y + col) + x + row];
-                        sum_y += filter[col + 1] * row * op[width * (y + col) + x + row];
-                    }
-                }
-            }
-            int color = sqrtf(sum_x * sum_x + sum_y * sum_y);
-            if (color > 255) color = 255;
-            else if (color < 0) color = 0;
-            np[width * y + x] = (uchar)color;
-        }
-    }
+inline void sobel_operator(uchar* op, uchar* np, int width, int height)
+{
+    sobel_operator(op, (size_t)width, np, (size_t)width, width, height);
 }
 
 inline void gaussian_blur_operator(pixel* op, pixel* np, int width, int height)
 {
-    const int filter[][5] = {
-        { 2, 4, 5, 4, 2},
-        { 4, 9,12, 9, 4},
-        { 5,12,15,12, 5},
-        { 4, 9,12, 9, 4},
-        { 2, 4, 5, 4, 2}
-    };
-    const float divide_factor = 1 / 159.0f;
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            int sum = 0;
-            for (int row = -2; row < 3; row++) {
-                for (int col = -2; col < 3; col++) {
-                    if (x + row >= 0 && x + row < width && y + col >= 0 && y + col < height) {
-                        sum += filter[row + 2][col + 2] * op[width * (y + col) + x + row];
-                    }
-                }
-            }
-
-            int color = sum * divide_factor;
-            if (color > 255) color = 255;
-            else if (color < 0) color = 0;
-            np[width * y + x] = (uchar)color;
-        }
-    }
+    stencil::apply<gaussian_159_op, stencil::BorderZero>(op, width, np, width, width, height);
 }
 
 inline void non_maximum_suppression_operator(pixel* op, pixel* np, int width, int height)
@@ -97,11 +73,8 @@ inline void non_maximum_suppression_operator(pixel* op, pixel* np, int width, in
     }
 }
 
-inline void double_threshold_operator(pixel* p, int width, int height)
+inline void double_threshold_operator(pixel* p, int width, int height, pixel low = 0.2f * 256, pixel high = 0.8f * 256)
 {
-    const pixel low = 0.2f * 256;
-    const pixel high = 0.8f * 256;
-
     for (int y = 0; y < height; ++y) {
         for (int x = 0; x < width; ++x) {
             pixel current = p[width * y + x];
@@ -119,4 +92,119 @@ inline void double_threshold_operator(pixel* p, int width, int height)
             }
         }
     }
-}
\ No newline at end of file
+}
+
+// Canny as the kernels of Sobel.cl run it, so that the CPU and OpenCL backends find the
+// same edges : replicated borders, the 5x5 blur rounded to nearest, the squared Sobel
+// magnitude with a quantized direction, suppression along the gradient fused with the
+// double threshold, then hysteresis over 8 neighbours.
+const pixel CANNY_WEAK = 128;
+const pixel CANNY_STRONG = 255;
+
+inline void canny_blur_operator(const pixel* op, size_t opStride, pixel* np, int width, int height)
+{
+    stencil::apply<canny_blur_op, stencil::BorderReplicate>(op, opStride, np, (size_t)width, width, height);
+}
+
+// Writes (squared magnitude << 2) | direction, the direction being
+// 0: horizontal, 1: diagonal (\), 2: vertical, 3: anti-diagonal (/)
+inline void canny_gradient_operator(const pixel* op, uint32_t* gradient, int width, int height)
+{
+    for (int y = 0; y < height; ++y) {
+        const pixel* above = op + width * std::max(y - 1, 0);
+        const pixel* row = op + width * y;
+        const pixel* below = op + width * std::min(y + 1, height - 1);
+
+        for (int x = 0; x < width; ++x) {
+            int left = std::max(x - 1, 0);
+            int right = std::min(x + 1, width - 1);
+            int gx = -above[left] + above[right] + 2 * (row[right] - row[left]) - below[left] + below[right];
+            int gy = -above[left] - above[right] + 2 * (below[x] - above[x]) + below[left] + below[right];
+
+            // tan(22.5) in Q15, as in OpenCV
+            uint32_t ax = (uint32_t)abs(gx);
+            uint32_t ay = (uint32_t)abs(gy);
+            uint32_t tg22x = ax * 13573;
+            uint32_t ay15 = ay << 15;
+            uint32_t direction;
+            if (ay15 < tg22x) {
+                direction = 0;
+            }
+            else if (ay15 > tg22x + (ax << 16)) {
+                direction = 2;
+            }
+            else {
+                direction = ((gx ^ gy) < 0) ? 3 : 1;
+            }
+
+            gradient[width * y + x] = ((uint32_t)(gx * gx + gy * gy) << 2) | direction;
+        }
+    }
+}
+
+inline uint32_t canny_magnitude(const uint32_t* gradient, int x, int y, int width, int height)
+{
+    if (x < 0 || x >= width || y < 0 || y >= height) {
+        return 0;
+    }
+    return gradient[width * y + x] >> 2;
+}
+
+// Thresholds are squared to match the stored magnitude
+inline void canny_suppression_operator(const uint32_t* gradient, pixel* edges, int width, int height, uint32_t lowSquared, uint32_t highSquared)
+{
+    static const int dx[4] = { 1, 1, 0, 1 };
+    static const int dy[4] = { 0, 1, 1, -1 };
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            uint32_t g = gradient[width * y + x];
+            uint32_t magnitude = g >> 2;
+            int d = g & 3;
+
+            uint32_t m1 = canny_magnitude(gradient, x + dx[d], y + dy[d], width, height);
+            uint32_t m2 = canny_magnitude(gradient, x - dx[d], y - dy[d], width, height);
+
+            pixel result = 0;
+            if (magnitude > lowSquared && magnitude > m1 && magnitude >= m2) {
+                result = magnitude > highSquared ? CANNY_STRONG : CANNY_WEAK;
+            }
+            edges[width * y + x] = result;
+        }
+    }
+}
+
+// Promotes the weak pixels connected to strong ones, then maps strong pixels to 255 and
+// the rest to 0. stack is scratch space the caller keeps between frames.
+inline void canny_hysteresis_operator(pixel* edges, int width, int height, std::vector<int>& stack)
+{
+    const int count = width * height;
+
+    stack.clear();
+    for (int i = 0; i < count; ++i) {
+        if (edges[i] == CANNY_STRONG) {
+            stack.push_back(i);
+        }
+    }
+
+    while (!stack.empty()) {
+        int i = stack.back();
+        stack.pop_back();
+
+        int x = i % width;
+        int y = i / width;
+        for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1); ++ny) {
+            for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1); ++nx) {
+                int j = width * ny + nx;
+                if (edges[j] == CANNY_WEAK) {
+                    edges[j] = CANNY_STRONG;
+                    stack.push_back(j);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        edges[i] = edges[i] == CANNY_STRONG ? 255 : 0;
+    }
+}
@@ -0,0 +1,550 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Compile-time specialized stencil engine.
+//
+// A filter is described entirely by types: its kernels are lists of integer taps
+// and its output is produced by a combine policy. apply<Op>() expands the kernels
+// into fully unrolled multiply-adds (zero taps generate no code at all), evaluates
+// separable kernels as a vertical pass followed by a horizontal pass, and handles
+// borders by padding each input row once instead of checking bounds per pixel.
+// clBuildOptions<Op>() emits the same coefficients as -D options for Stencil.cl,
+// so both backends are generated from one definition.
+namespace stencil
+{
+	typedef unsigned char uchar;
+
+	template <int... Values>
+	struct Taps
+	{
+		static constexpr int size = sizeof...(Values);
+
+		static const int* values()
+		{
+			static const int v[] = { Values... };
+			return v;
+		}
+	};
+
+	template <int Index, class T>
+	struct TapAt;
+
+	template <int Head, int... Tail>
+	struct TapAt<0, Taps<Head, Tail...>>
+	{
+		static constexpr int value = Head;
+	};
+
+	template <int Index, int Head, int... Tail>
+	struct TapAt<Index, Taps<Head, Tail...>> : TapAt<Index - 1, Taps<Tail...>>
+	{
+	};
+
+	// Multiplies by a compile-time coefficient. Zero taps do not even load the pixel.
+	template <int Coeff>
+	struct Term
+	{
+		template <class P>
+		static inline int apply(const P* p) { return Coeff * (int)*p; }
+	};
+
+	template <>
+	struct Term<0>
+	{
+		template <class P>
+		static inline int apply(const P*) { return 0; }
+	};
+
+	template <>
+	struct Term<1>
+	{
+		template <class P>
+		static inline int apply(const P* p) { return (int)*p; }
+	};
+
+	// sum(T[i] * p[i * Step]) for a window of every Step-th element (Step > 1 : one channel of an interleaved row)
+	template <class T, int Step = 1, int I = 0, int N = T::size>
+	struct Dot
+	{
+		template <class P>
+		static inline int apply(const P* p)
+		{
+			return Term<TapAt<I, T>::value>::apply(p + I * Step) + Dot<T, Step, I + 1, N>::apply(p);
+		}
+	};
+
+	template <class T, int Step, int N>
+	struct Dot<T, Step, N, N>
+	{
+		template <class P>
+		static inline int apply(const P*) { return 0; }
+	};
+
+	// sum(T[i] * rows[i][x]) down a column of row pointers
+	template <class T, int I = 0, int N = T::size>
+	struct ColumnDot
+	{
+		static inline int apply(const uchar* const* rows, int x)
+		{
+			return Term<TapAt<I, T>::value>::apply(rows[I] + x) + ColumnDot<T, I + 1, N>::apply(rows, x);
+		}
+	};
+
+	template <class T, int N>
+	struct ColumnDot<T, N, N>
+	{
+		static inline int apply(const uchar* const*, int) { return 0; }
+	};
+
+	// sum(T[i] * rows[i / Size][x + i % Size]) over a square window
+	template <class T, int Size, int I = 0, int N = T::size>
+	struct WindowDot
+	{
+		static inline int apply(const uchar* const* rows, int x)
+		{
+			return Term<TapAt<I, T>::value>::apply(rows[I / Size] + x + I % Size) + WindowDot<T, Size, I + 1, N>::apply(rows, x);
+		}
+	};
+
+	template <class T, int Size, int N>
+	struct WindowDot<T, Size, N, N>
+	{
+		static inline int apply(const uchar* const*, int) { return 0; }
+	};
+
+	//------------------------------------------------------------------
+	// Kernels
+
+	// K(y, x) = Col[y] * Row[x]
+	template <class RowTaps, class ColTaps>
+	struct Separable
+	{
+		static_assert(RowTaps::size == ColTaps::size, "Separable kernel must be square");
+		static_assert(RowTaps::size % 2 == 1, "Kernel size must be odd");
+
+		typedef RowTaps Row;
+		typedef ColTaps Col;
+		static constexpr int size = RowTaps::size;
+
+		static int coefficient(int y, int x) { return Col::values()[y] * Row::values()[x]; }
+	};
+
+	// Non-separable square kernel, taps in row-major order
+	template <int Size, class AllTaps>
+	struct Dense
+	{
+		static_assert(AllTaps::size == Size * Size, "Dense kernel needs Size * Size taps");
+		static_assert(Size % 2 == 1, "Kernel size must be odd");
+
+		typedef AllTaps Coeffs;
+		static constexpr int size = Size;
+
+		static int coefficient(int y, int x) { return Coeffs::values()[y * Size + x]; }
+	};
+
+	// Placeholder for operators with a single kernel
+	struct NoKernel
+	{
+		static constexpr int size = 1;
+
+		static int coefficient(int, int) { return 0; }
+	};
+
+	//------------------------------------------------------------------
+	// Combine policies : map the kernel responses (a, b) to an output pixel
+
+	inline uchar saturate(int v)
+	{
+		return (uchar)(v < 0 ? 0 : (v > 255 ? 255 : v));
+	}
+
+	struct MagnitudeL1
+	{
+		static const char* clName() { return "COMBINE_L1"; }
+		static inline uchar apply(int a, int b) { return saturate(std::abs(a) + std::abs(b)); }
+	};
+
+	struct MagnitudeL2
+	{
+		static const char* clName() { return "COMBINE_L2"; }
+		static inline uchar apply(int a, int b) { return saturate((int)sqrtf((float)(a * a + b * b))); }
+	};
+
+	struct Absolute
+	{
+		static const char* clName() { return "COMBINE_ABS"; }
+		static inline uchar apply(int a, int) { return saturate(std::abs(a)); }
+	};
+
+	// (sat(|a|) + sat(|b|)) / 2 rounded half to even : the result of
+	// convertScaleAbs on both gradients followed by addWeighted(0.5, 0.5) in OpenCV
+	struct HalfSumAbs
+	{
+		static const char* clName() { return "COMBINE_HALF_SUM"; }
+		static inline uchar apply(int a, int b)
+		{
+			int sum = saturate(std::abs(a)) + saturate(std::abs(b));
+			return (uchar)((sum + ((sum >> 1) & 1)) >> 1);
+		}
+	};
+
+	// Truncating division, computed the same way as the original gaussian_blur_operator
+	template <int Divisor>
+	struct Normalize
+	{
+		static const char* clName() { return "COMBINE_NORMALIZE"; }
+		static constexpr int divisor = Divisor;
+		static inline uchar apply(int a, int) { return saturate((int)(a * (1.0f / Divisor))); }
+	};
+
+	// Integer division rounded to nearest, as canny_blur in Sobel.cl. CPU only : Stencil.cl
+	// has no counterpart, so there is no clName().
+	template <int Divisor>
+	struct NormalizeRound
+	{
+		static constexpr int divisor = Divisor;
+		static inline uchar apply(int a, int) { return saturate((a + Divisor / 2) / Divisor); }
+	};
+
+	//------------------------------------------------------------------
+	// Channel policies : fold the combined outputs of the channels of one pixel
+
+	struct ChannelMax
+	{
+		static inline int fold(int acc, int v) { return acc > v ? acc : v; }
+	};
+
+	struct ChannelSum
+	{
+		static inline int fold(int acc, int v) { return acc + v; }
+	};
+
+	//------------------------------------------------------------------
+	// Borders : index(i, n) maps an out-of-range coordinate back into [0, n)
+
+	struct BorderReplicate
+	{
+		static constexpr bool zero = false;
+		static const char* clName() { return ""; }
+		static inline int index(int i, int n) { return i < 0 ? 0 : (i >= n ? n - 1 : i); }
+	};
+
+	struct BorderZero
+	{
+		static constexpr bool zero = true;
+		static const char* clName() { return "BORDER_ZERO"; }
+		static inline int index(int i, int n) { return i < 0 ? 0 : (i >= n ? n - 1 : i); }
+	};
+
+	// gfedcb|abcdefgh|gfedcba, OpenCV's BORDER_DEFAULT. CPU only : OpenCL images
+	// can not mirror unnormalized coordinates, so there is no clName().
+	struct BorderReflect101
+	{
+		static constexpr bool zero = false;
+		static inline int index(int i, int n)
+		{
+			if (n == 1) {
+				return 0;
+			}
+			while (i < 0 || i >= n) {
+				i = i < 0 ? -i : 2 * (n - 1) - i;
+			}
+			return i;
+		}
+	};
+
+	//------------------------------------------------------------------
+	// Operators
+
+	template <class CombinePolicy, class KernelA, class KernelB = NoKernel>
+	struct Operator
+	{
+		typedef CombinePolicy Combine;
+		typedef KernelA A;
+		typedef KernelB B;
+		static constexpr int radius = (KernelA::size > KernelB::size ? KernelA::size : KernelB::size) / 2;
+	};
+
+	template <class SmoothTaps, class DiffTaps, class Combine = MagnitudeL1>
+	using Gradient = Operator<Combine, Separable<DiffTaps, SmoothTaps>, Separable<SmoothTaps, DiffTaps>>;
+
+	typedef Gradient<Taps<1, 2, 1>, Taps<-1, 0, 1>> Sobel;
+	typedef Gradient<Taps<3, 10, 3>, Taps<-1, 0, 1>> Scharr;
+	typedef Gradient<Taps<1, 1, 1>, Taps<-1, 0, 1>> Prewitt;
+	typedef Operator<Normalize<16>, Separable<Taps<1, 2, 1>, Taps<1, 2, 1>>> Gaussian3x3;
+	typedef Operator<Normalize<256>, Separable<Taps<1, 4, 6, 4, 1>, Taps<1, 4, 6, 4, 1>>> Gaussian5x5;
+	typedef Operator<Absolute, Dense<3, Taps<0, 1, 0, 1, -4, 1, 0, 1, 0>>> Laplacian;
+
+	//------------------------------------------------------------------
+	// CPU evaluation
+
+	// Keeps the (2 * radius + 1) source rows needed for one output row, each padded
+	// by radius pixels on both sides according to the border policy.
+	// Rows of interleaved images hold Channels bytes per pixel and are padded pixel by pixel.
+	// Output rows must be requested in increasing order starting at firstRow.
+	template <class Border, int Channels = 1>
+	class RowCache
+	{
+	public:
+		RowCache(const uchar* src, size_t srcStride, int width, int height, int radius, int firstRow = 0) :
+			src_(src),
+			srcStride_(srcStride),
+			width_(width),
+			height_(height),
+			radius_(radius),
+			window_(2 * radius + 1),
+			paddedWidth_((width + 2 * radius) * Channels),
+			storage_((size_t)(window_ + 1) * paddedWidth_, 0),
+			lastLoaded_(std::max(-1, firstRow - radius - 1))
+		{
+		}
+
+		// In bytes, i.e. pixels * Channels
+		int paddedWidth() const { return paddedWidth_; }
+
+		// rows[i] = padded source row (y - radius + i)
+		void rowsFor(int y, const uchar** rows)
+		{
+			for (int i = 0; i < window_; ++i) {
+				int sy = y - radius_ + i;
+				if (sy < 0 || sy >= height_) {
+					if (Border::zero) {
+						rows[i] = zeroRow();
+						continue;
+					}
+					sy = Border::index(sy, height_);
+				}
+
+				while (lastLoaded_ < sy) {
+					load(++lastLoaded_);
+				}
+				rows[i] = slot(sy);
+			}
+		}
+
+	private:
+		uchar* slot(int sy) { return &storage_[(size_t)(sy % window_) * paddedWidth_]; }
+		const uchar* zeroRow() const { return &storage_[(size_t)window_ * paddedWidth_]; }
+
+		void load(int sy)
+		{
+			const uchar* in = src_ + srcStride_ * sy;
+			uchar* out = slot(sy);
+
+			memcpy(out + radius_ * Channels, in, (size_t)width_ * Channels);
+			for (int i = 0; i < radius_; ++i) {
+				for (int c = 0; c < Channels; ++c) {
+					out[i * Channels + c] = Border::zero ? 0 : in[Border::index(i - radius_, width_) * Channels + c];
+					out[(radius_ + width_ + i) * Channels + c] = Border::zero ? 0 : in[Border::index(width_ + i, width_) * Channels + c];
+				}
+			}
+		}
+
+		const uchar* src_;
+		size_t srcStride_;
+		int width_;
+		int height_;
+		int radius_;
+		int window_;
+		int paddedWidth_;
+		std::vector<uchar> storage_;
+		int lastLoaded_;
+	};
+
+	// Per-row evaluator of one kernel. rows/x are in the operator's padded coordinates,
+	// offset is (operator radius - kernel radius). With Channels > 1, x indexes the bytes
+	// of an interleaved row and each channel only sees its own samples.
+	template <class Kernel, int Channels = 1>
+	struct Component;
+
+	template <class Row, class Col, int Channels>
+	struct Component<Separable<Row, Col>, Channels>
+	{
+		Component(int paddedWidth) : vertical_(paddedWidth) {}
+
+		void prepare(const uchar* const* rows, int offset)
+		{
+			const uchar* const* kernelRows = rows + offset;
+			const int n = (int)vertical_.size();
+			int* v = &vertical_[0];
+			// Channel-agnostic : the vertical taps never mix neighbouring bytes
+			for (int x = 0; x < n; ++x) {
+				v[x] = ColumnDot<Col>::apply(kernelRows, x);
+			}
+			offset_ = offset * Channels;
+		}
+
+		inline int at(int x) const { return Dot<Row, Channels>::apply(&vertical_[0] + x + offset_); }
+
+		std::vector<int> vertical_;
+		int offset_ = 0;
+	};
+
+	// Single channel only
+	template <int Size, class AllTaps>
+	struct Component<Dense<Size, AllTaps>, 1>
+	{
+		Component(int) {}
+
+		void prepare(const uchar* const* rows, int offset)
+		{
+			rows_ = rows + offset;
+			offset_ = offset;
+		}
+
+		inline int at(int x) const { return WindowDot<AllTaps, Size>::apply(rows_, x + offset_); }
+
+		const uchar* const* rows_ = nullptr;
+		int offset_ = 0;
+	};
+
+	template <int Channels>
+	struct Component<NoKernel, Channels>
+	{
+		Component(int) {}
+		void prepare(const uchar* const*, int) {}
+		inline int at(int) const { return 0; }
+	};
+
+	// Filters output rows [rowBegin, rowEnd) of a width x height image.
+	// Disjoint row ranges may run concurrently.
+	template <class Op, class Border = BorderReplicate>
+	void applyRows(const uchar* src, size_t srcStride, uchar* dst, size_t dstStride, int width, int height, int rowBegin, int rowEnd)
+	{
+		const int radius = Op::radius;
+		RowCache<Border> cache(src, srcStride, width, height, radius, rowBegin);
+		Component<typename Op::A> a(cache.paddedWidth());
+		Component<typename Op::B> b(cache.paddedWidth());
+		const uchar* rows[2 * Op::radius + 1];
+
+		for (int y = rowBegin; y < rowEnd; ++y) {
+			cache.rowsFor(y, rows);
+			a.prepare(rows, radius - Op::A::size / 2);
+			b.prepare(rows, radius - Op::B::size / 2);
+
+			uchar* out = dst + dstStride * y;
+			for (int x = 0; x < width; ++x) {
+				out[x] = Op::Combine::apply(a.at(x), b.at(x));
+			}
+		}
+	}
+
+	template <class Op, class Border = BorderReplicate>
+	void apply(const uchar* src, size_t srcStride, uchar* dst, size_t dstStride, int width, int height)
+	{
+		applyRows<Op, Border>(src, srcStride, dst, dstStride, width, height, 0, height);
+	}
+
+	// Filters rows [rowBegin, rowEnd) of an interleaved image with Channels bytes per pixel
+	// (e.g. BGR) into a single channel : Op runs on every channel and Fold merges the
+	// per-channel outputs, saturated. Both passes walk the interleaved row as one flat array,
+	// so all channels are computed together rather than in one pass per channel.
+	template <class Op, class Fold, int Channels = 3, class Border = BorderReplicate>
+	void applyInterleavedRows(const uchar* src, size_t srcStride, uchar* dst, size_t dstStride, int width, int height, int rowBegin, int rowEnd)
+	{
+		const int radius = Op::radius;
+		RowCache<Border, Channels> cache(src, srcStride, width, height, radius, rowBegin);
+		Component<typename Op::A, Channels> a(cache.paddedWidth());
+		Component<typename Op::B, Channels> b(cache.paddedWidth());
+		const uchar* rows[2 * Op::radius + 1];
+		std::vector<uchar> combined((size_t)width * Channels);
+		uchar* c = &combined[0];
+		const int n = width * Channels;
+
+		for (int y = rowBegin; y < rowEnd; ++y) {
+			cache.rowsFor(y, rows);
+			a.prepare(rows, radius - Op::A::size / 2);
+			b.prepare(rows, radius - Op::B::size / 2);
+
+			for (int i = 0; i < n; ++i) {
+				c[i] = Op::Combine::apply(a.at(i), b.at(i));
+			}
+
+			uchar* out = dst + dstStride * y;
+			for (int x = 0; x < width; ++x) {
+				int v = c[x * Channels];
+				for (int ch = 1; ch < Channels; ++ch) {
+					v = Fold::fold(v, c[x * Channels + ch]);
+				}
+				out[x] = saturate(v);
+			}
+		}
+	}
+
+	// Calls visit(x, y, a, b) with the raw kernel responses of rows [rowBegin, rowEnd)
+	// instead of writing combined pixels, for reductions that need more than the
+	// output value (e.g. the gradient direction).
+	template <class Op, class Border, class Visitor>
+	void visitRows(const uchar* src, size_t srcStride, int width, int height, int rowBegin, int rowEnd, Visitor& visit)
+	{
+		const int radius = Op::radius;
+		RowCache<Border> cache(src, srcStride, width, height, radius, rowBegin);
+		Component<typename Op::A> a(cache.paddedWidth());
+		Component<typename Op::B> b(cache.paddedWidth());
+		const uchar* rows[2 * Op::radius + 1];
+
+		for (int y = rowBegin; y < rowEnd; ++y) {
+			cache.rowsFor(y, rows);
+			a.prepare(rows, radius - Op::A::size / 2);
+			b.prepare(rows, radius - Op::B::size / 2);
+
+			for (int x = 0; x < width; ++x) {
+				visit(x, y, a.at(x), b.at(x));
+			}
+		}
+	}
+
+	//------------------------------------------------------------------
+	// OpenCL generation
+
+	namespace detail
+	{
+		template <class Kernel>
+		void writeKernelOptions(std::ostringstream& ss, char name)
+		{
+			ss << " -D KSIZE_" << name << "=" << Kernel::size;
+			ss << " -D COEFFS_" << name << "=";
+			for (int y = 0; y < Kernel::size; ++y) {
+				for (int x = 0; x < Kernel::size; ++x) {
+					ss << (y + x > 0 ? "," : "") << Kernel::coefficient(y, x);
+				}
+			}
+		}
+
+		template <class Combine>
+		struct Divisor
+		{
+			static int value() { return 1; }
+		};
+
+		template <int D>
+		struct Divisor<Normalize<D>>
+		{
+			static int value() { return D; }
+		};
+	}
+
+	// Build options for Stencil.cl reproducing Op with the given border policy
+	template <class Op, class Border = BorderReplicate>
+	std::string clBuildOptions()
+	{
+		std::ostringstream ss;
+		ss << "-D " << Op::Combine::clName();
+		ss << " -D DIVISOR=" << detail::Divisor<typename Op::Combine>::value();
+		detail::writeKernelOptions<typename Op::A>(ss, 'A');
+		detail::writeKernelOptions<typename Op::B>(ss, 'B');
+		if (*Border::clName() != '\0') {
+			ss << " -D " << Border::clName();
+		}
+
+		return ss.str();
+	}
+}
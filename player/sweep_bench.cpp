@@ -0,0 +1,375 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "vivante.h"
+#include "RawStream.h"
+#include "SyntheticFrames.h"
+
+// Resolution sweep : runs every backend on synthetic frames from 64x64 to 4K and
+// reports per-frame latency and throughput, as CSV plus an optional gnuplot script.
+// Frames are rendered before timing and only Filter::process is measured, including
+// the OpenCL upload and download. Auto's numbers include its selection phase.
+//
+// Usage : ./sweep_bench [options]
+//   --sizes WxH,...        default 64x64 up to 3840x2160
+//   --backends a,b,...     CPU, OpenCV, OpenCL, Fused, Auto (default : all)
+//   --operator name        default Sobel
+//   --pattern name         noise, gradient, shapes, static (default shapes)
+//   --frames n             timed frames per run (default 50)
+//   --warmup n             untimed frames per run (default 5)
+//   --seed n               synthetic frame seed (default 1)
+//   --blur-sigma s         Gaussian pre-filter
+//   --csv path             default stdout
+//   --gnuplot path         writes a script plotting the CSV
+//   --generate WxH         writes --frames synthetic frames as mono Y4M to stdout instead
+
+constexpr const char* DEFAULT_SIZES = "64x64,128x128,256x256,640x480,1280x720,1920x1080,2560x1440,3840x2160";
+constexpr const char* DEFAULT_BACKENDS = "CPU,OpenCV,OpenCL,Fused,Auto";
+
+struct Size
+{
+	int width;
+	int height;
+};
+
+struct BackendChoice
+{
+	std::string label;			// as given on the command line, no spaces for CSV and gnuplot
+	vivante::Backend backend;
+};
+
+struct Result
+{
+	std::string label;
+	std::string device;
+	Size size;
+	int frames;
+	double median_ms;
+	double p95_ms;
+	double max_ms;
+	double meanFilter_ms;		// as reported by Filter::process
+	double fps;
+	std::string active;			// backend that processed the last frame
+};
+
+bool parseSize(const std::string& text, Size& size)
+{
+	char tail = 0;
+	return sscanf(text.c_str(), "%dx%d%c", &size.width, &size.height, &tail) == 2 && size.width > 0 && size.height > 0;
+}
+
+std::vector<std::string> split(const char* list)
+{
+	std::vector<std::string> items;
+	std::string item;
+	for (const char* c = list; ; ++c) {
+		if (*c == ',' || *c == '\0') {
+			if (item.empty() == false) {
+				items.push_back(item);
+			}
+			item.clear();
+			if (*c == '\0') {
+				break;
+			}
+		}
+		else {
+			item += *c;
+		}
+	}
+
+	return items;
+}
+
+double percentile(std::vector<double> samples, double fraction)
+{
+	size_t index = std::min(samples.size() - 1, (size_t)std::ceil(fraction * samples.size()) - (fraction > 0.0 ? 1 : 0));
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+	return samples[index];
+}
+
+// Writes synthetic frames as a mono Y4M stream, e.g. to feed ./player --stream
+int generate(const Size& size, const SyntheticSource& source, int frames)
+{
+	StreamInfo info = { StreamFormat::Y4M, size.width, size.height, 0,
+		"YUV4MPEG2 W" + std::to_string(size.width) + " H" + std::to_string(size.height) + " F30:1 Ip A1:1 Cmono" };
+
+	try {
+		RawVideoWriter writer(STDOUT_FILENO, info);
+		std::vector<unsigned char> frame(info.lumaSize());
+		for (int i = 0; i < frames; ++i) {
+			source.render(i, &frame[0], size.width);
+			if (writer.write(&frame[0]) == false) {
+				break;
+			}
+		}
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "Error(Generate) : %s \n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+bool run(const BackendChoice& choice, const Size& size, const vivante::Options& options,
+	const std::vector<std::vector<unsigned char>>& frames, int warmup, int timed, Result& result)
+{
+	std::unique_ptr<vivante::Filter> filter;
+	try {
+		filter.reset(new vivante::Filter(choice.backend, size.width, size.height, options));
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "Skipping %s at %dx%d : %s \n", choice.label.c_str(), size.width, size.height, e.what());
+		return false;
+	}
+
+	std::vector<unsigned char> output((size_t)size.width * size.height);
+	vivante::Plane dst = { &output[0], size.width, size.height, (size_t)size.width };
+	std::vector<double> latencies;
+	latencies.reserve(timed);
+	double filterSum_ms = 0.0;
+	double total_ms = 0.0;
+
+	try {
+		for (int i = 0; i < warmup + timed; ++i) {
+			const std::vector<unsigned char>& frame = frames[i % frames.size()];
+			vivante::ConstPlane src = { &frame[0], size.width, size.height, (size_t)size.width };
+
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			double filter_ms = filter->process(src, dst);
+			double latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			if (i >= warmup) {
+				latencies.push_back(latency_ms);
+				filterSum_ms += filter_ms;
+				total_ms += latency_ms;
+			}
+		}
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "Skipping %s at %dx%d : %s \n", choice.label.c_str(), size.width, size.height, e.what());
+		return false;
+	}
+
+	result.label = choice.label;
+	result.device = filter->device();
+	result.size = size;
+	result.frames = timed;
+	result.median_ms = percentile(latencies, 0.5);
+	result.p95_ms = percentile(latencies, 0.95);
+	result.max_ms = *std::max_element(latencies.begin(), latencies.end());
+	result.meanFilter_ms = filterSum_ms / timed;
+	result.fps = total_ms > 0.0 ? 1000.0 * timed / total_ms : 0.0;
+	result.active = vivante::backendName(filter->activeBackend());
+
+	return true;
+}
+
+void writeCsv(FILE* file, const std::vector<Result>& results)
+{
+	fprintf(file, "backend,device,width,height,pixels,frames,median_ms,p95_ms,max_ms,mean_filter_ms,fps,mpix_per_s,active\n");
+	for (const Result& r : results) {
+		double pixels = (double)r.size.width * r.size.height;
+		std::string device = r.device;
+		std::replace(device.begin(), device.end(), ',', ' ');
+		fprintf(file, "%s,%s,%d,%d,%.0f,%d,%.4f,%.4f,%.4f,%.4f,%.2f,%.2f,%s\n",
+			r.label.c_str(), device.c_str(), r.size.width, r.size.height, pixels, r.frames,
+			r.median_ms, r.p95_ms, r.max_ms, r.meanFilter_ms, r.fps, r.fps * pixels / 1e6, r.active.c_str());
+	}
+}
+
+// Two log-log plots against the frame size : throughput and median/p95 latency
+bool writeGnuplot(const char* path, const char* csvPath, const std::vector<BackendChoice>& backends)
+{
+	FILE* file = fopen(path, "w");
+	if (file == nullptr) {
+		return false;
+	}
+
+	fprintf(file, "# gnuplot %s\n", path);
+	fprintf(file, "set datafile separator \",\"\n");
+	fprintf(file, "set terminal pngcairo size 1280,960\n");
+	fprintf(file, "set output \"%s.png\"\n", path);
+	fprintf(file, "set multiplot layout 2,1\n");
+	fprintf(file, "set logscale xy\n");
+	fprintf(file, "set grid\n");
+	fprintf(file, "set key outside right\n");
+	fprintf(file, "set xlabel \"pixels per frame\"\n");
+
+	fprintf(file, "set ylabel \"Mpixel/s\"\n");
+	fprintf(file, "plot");
+	for (size_t i = 0; i < backends.size(); ++i) {
+		const char* name = backends[i].label.c_str();
+		fprintf(file, "%s \"%s\" using 5:(strcol(1) eq \"%s\" ? $12 : NaN) with linespoints title \"%s\"",
+			i == 0 ? "" : ", \\\n    ", csvPath, name, name);
+	}
+	fprintf(file, "\n");
+
+	fprintf(file, "set ylabel \"latency (ms)\"\n");
+	fprintf(file, "plot");
+	for (size_t i = 0; i < backends.size(); ++i) {
+		const char* name = backends[i].label.c_str();
+		fprintf(file, "%s \"%s\" using 5:(strcol(1) eq \"%s\" ? $7 : NaN) with linespoints title \"%s median\", \\\n",
+			i == 0 ? "" : ", \\\n    ", csvPath, name, name);
+		fprintf(file, "     \"%s\" using 5:(strcol(1) eq \"%s\" ? $8 : NaN) with lines dashtype 2 title \"%s p95\"",
+			csvPath, name, name);
+	}
+	fprintf(file, "\n");
+	fprintf(file, "unset multiplot\n");
+
+	fclose(file);
+	return true;
+}
+
+// Throughput bars on a log scale, one group per size
+void printChart(const std::vector<Result>& results)
+{
+	const int WIDTH = 50;
+	double lo = 1e300;
+	double hi = 0.0;
+	for (const Result& r : results) {
+		double mpix = r.fps * r.size.width * r.size.height / 1e6;
+		if (mpix > 0.0) {
+			lo = std::min(lo, mpix);
+			hi = std::max(hi, mpix);
+		}
+	}
+	if (hi <= 0.0) {
+		return;
+	}
+	double span = std::max(std::log10(hi / lo), 1.0);
+
+	fprintf(stderr, "\nThroughput (Mpixel/s, log scale) \n");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result& r = results[i];
+		if (i == 0 || r.size.width != results[i - 1].size.width || r.size.height != results[i - 1].size.height) {
+			fprintf(stderr, "%dx%d \n", r.size.width, r.size.height);
+		}
+		double mpix = r.fps * r.size.width * r.size.height / 1e6;
+		int bar = mpix > 0.0 ? 1 + (int)((WIDTH - 1) * std::log10(mpix / lo) / span) : 0;
+		fprintf(stderr, "  %-8s %s %.1f \n", r.label.c_str(), std::string(bar, '#').c_str(), mpix);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const char* sizeList = DEFAULT_SIZES;
+	const char* backendList = DEFAULT_BACKENDS;
+	const char* csvPath = nullptr;
+	const char* gnuplotPath = nullptr;
+	const char* generateSize = nullptr;
+	SyntheticPattern pattern = SyntheticPattern::Shapes;
+	int frameCount = 50;
+	int warmup = 5;
+	uint32_t seed = 1;
+	vivante::Options options;
+
+	bool valid = true;
+	for (int i = 1; i < argc && valid; ++i) {
+		// Every option takes a value
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[++i] : nullptr;
+
+		if (value == nullptr)									valid = false;
+		else if (strcmp(arg, "--sizes") == 0)					sizeList = value;
+		else if (strcmp(arg, "--backends") == 0)				backendList = value;
+		else if (strcmp(arg, "--operator") == 0)				valid = vivante::parseOperator(value, options.op);
+		else if (strcmp(arg, "--pattern") == 0)					valid = parsePattern(value, pattern);
+		else if (strcmp(arg, "--frames") == 0)					valid = (frameCount = atoi(value)) > 0;
+		else if (strcmp(arg, "--warmup") == 0)					valid = (warmup = atoi(value)) >= 0;
+		else if (strcmp(arg, "--seed") == 0)					seed = (uint32_t)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--blur-sigma") == 0)				options.blurSigma = (float)atof(value);
+		else if (strcmp(arg, "--csv") == 0)						csvPath = value;
+		else if (strcmp(arg, "--gnuplot") == 0)				gnuplotPath = value;
+		else if (strcmp(arg, "--generate") == 0)				generateSize = value;
+		else													valid = false;
+	}
+
+	std::vector<Size> sizes;
+	for (const std::string& item : split(sizeList)) {
+		Size size;
+		valid = valid && parseSize(item, size);
+		sizes.push_back(size);
+	}
+
+	std::vector<BackendChoice> backends;
+	for (const std::string& item : split(backendList)) {
+		BackendChoice choice = { item, vivante::Backend::CPU };
+		valid = valid && vivante::parseBackend(item.c_str(), choice.backend);
+		backends.push_back(choice);
+	}
+
+	if (valid == false || sizes.empty() || backends.empty()) {
+		fprintf(stderr, "Usage : ./sweep_bench [--sizes WxH,...] [--backends CPU,OpenCV,OpenCL,Fused,Auto] [--operator name] \n");
+		fprintf(stderr, "        [--pattern noise|gradient|shapes|static] [--frames n] [--warmup n] [--seed n] [--blur-sigma s] \n");
+		fprintf(stderr, "        [--csv path] [--gnuplot path] [--generate WxH] \n");
+		return EXIT_FAILURE;
+	}
+
+	if (generateSize) {
+		Size size;
+		if (parseSize(generateSize, size) == false) {
+			fprintf(stderr, "Invalid size %s \n", generateSize);
+			return EXIT_FAILURE;
+		}
+		return generate(size, SyntheticSource(pattern, size.width, size.height, seed), frameCount);
+	}
+
+	if (gnuplotPath && csvPath == nullptr) {
+		fprintf(stderr, "--gnuplot needs --csv \n");
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stderr, "Sweep : %s, %s frames, %d + %d per run \n", vivante::operatorName(options.op), patternName(pattern), warmup, frameCount);
+
+	std::vector<Result> results;
+	for (const Size& size : sizes) {
+		// Rendered once per size and shared by every backend, at most 16 distinct frames
+		SyntheticSource source(pattern, size.width, size.height, seed);
+		std::vector<std::vector<unsigned char>> frames(std::min(frameCount, 16));
+		for (size_t i = 0; i < frames.size(); ++i) {
+			frames[i].resize((size_t)size.width * size.height);
+			source.render((int64_t)i, &frames[i][0], size.width);
+		}
+
+		for (const BackendChoice& choice : backends) {
+			Result result;
+			if (run(choice, size, options, frames, warmup, frameCount, result)) {
+				fprintf(stderr, "%-8s %5dx%-5d median %8.3f ms, p95 %8.3f ms, %8.1f fps  [%s] \n",
+					result.label.c_str(), size.width, size.height, result.median_ms, result.p95_ms, result.fps, result.device.c_str());
+				results.push_back(result);
+			}
+		}
+	}
+
+	FILE* csv = csvPath ? fopen(csvPath, "w") : stdout;
+	if (csv == nullptr) {
+		fprintf(stderr, "Can not open %s \n", csvPath);
+		return EXIT_FAILURE;
+	}
+	writeCsv(csv, results);
+	if (csv != stdout) {
+		fclose(csv);
+	}
+
+	if (gnuplotPath) {
+		if (writeGnuplot(gnuplotPath, csvPath, backends) == false) {
+			fprintf(stderr, "Can not open %s \n", gnuplotPath);
+			return EXIT_FAILURE;
+		}
+		fprintf(stderr, "Plot with : gnuplot %s \n", gnuplotPath);
+	}
+
+	printChart(results);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,1057 @@
+#include "vivante.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "simple_sobel.h"
+#include "gaussian.h"
+#include "CLContext.h"
+
+namespace vivante
+{
+	class Filter::Impl
+	{
+	public:
+		virtual ~Impl() {}
+		virtual double process(const ConstPlane& src, const Plane& dst) = 0;
+
+		// Single-threaded host reduction, shared by the CPU backends
+		virtual double analyze(const ConstPlane& src, int edgeThreshold, EdgeStats& stats);
+
+		// Single-threaded interleaved pass, shared by the CPU backends
+		virtual double processColor(const ConstColorPlane& src, ColorCombine combine, const Plane& dst);
+
+		// True when the backend applies Options::blurSigma itself : OpenCL on the device,
+		// Auto through its own Filters. The others get the host pre-filter below.
+		virtual bool blursFrames() const { return false; }
+
+		virtual std::string device() const { return "host"; }
+
+		void enableHostBlur(float sigma, int width, int height);
+
+		// src blurred into an internal plane, or src itself without pre-filter.
+		// Adds the time spent to elapsed.
+		ConstPlane prefilter(const ConstPlane& src, double& elapsed);
+
+	private:
+		std::unique_ptr<gaussian::BoxBlur> blur_;
+		std::vector<uchar> blurred_;
+	};
+
+	namespace
+	{
+		double elapsedMs(const std::chrono::steady_clock::time_point& start)
+		{
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			return elapsed.count();
+		}
+
+		typedef void (*StencilFunc)(const uchar* src, size_t srcStride, uchar* dst, size_t dstStride, int width, int height);
+
+		// CPU implementation, OpenCL build options and kernel radius of each operator.
+		// clOptions is null when the operator has a hand-written OpenCL kernel,
+		// both are null for Canny which is not a single stencil.
+		struct StencilEntry
+		{
+			StencilFunc cpu;
+			std::string (*clOptions)();
+			int radius;
+		};
+
+		StencilEntry stencilFor(Operator op)
+		{
+			using namespace stencil;
+
+			switch (op) {
+			case Operator::Sobel:		return { &apply<sobel_l2_op, BorderZero>, nullptr, sobel_l2_op::radius };
+			case Operator::Scharr:		return { &apply<Scharr, BorderReplicate>, &clBuildOptions<Scharr, BorderReplicate>, Scharr::radius };
+			case Operator::Prewitt:		return { &apply<Prewitt, BorderReplicate>, &clBuildOptions<Prewitt, BorderReplicate>, Prewitt::radius };
+			case Operator::Gaussian3x3:	return { &apply<Gaussian3x3, BorderReplicate>, &clBuildOptions<Gaussian3x3, BorderReplicate>, Gaussian3x3::radius };
+			case Operator::Gaussian5x5:	return { &apply<Gaussian5x5, BorderReplicate>, &clBuildOptions<Gaussian5x5, BorderReplicate>, Gaussian5x5::radius };
+			case Operator::Laplacian:	return { &apply<Laplacian, BorderReplicate>, &clBuildOptions<Laplacian, BorderReplicate>, Laplacian::radius };
+			case Operator::Canny:		return { nullptr, nullptr, 0 };
+			}
+
+			throw std::invalid_argument("Unknown operator");
+		}
+
+		//------------------------------------------------------------------
+		// Edge statistics on the host, bin for bin the same as sobel_stats in Sobel.cl
+
+		const int STATS_REGIONS = EdgeStats::GRID * EdgeStats::GRID;
+
+		static_assert(EdgeStats::GRID == CLContext::STATS_GRID, "EdgeStats and sobel_stats must use the same grid");
+		static_assert(EdgeStats::ORIENTATION_BINS == CLContext::STATS_BINS, "EdgeStats and sobel_stats must use the same bins");
+
+		struct StatsCounters
+		{
+			uint64_t edges = 0;
+			uint64_t sum = 0;
+			uint64_t orientation[EdgeStats::ORIENTATION_BINS] = {};
+			uint64_t regions[STATS_REGIONS] = {};
+
+			void merge(const StatsCounters& other)
+			{
+				edges += other.edges;
+				sum += other.sum;
+				for (int i = 0; i < EdgeStats::ORIENTATION_BINS; ++i) {
+					orientation[i] += other.orientation[i];
+				}
+				for (int i = 0; i < STATS_REGIONS; ++i) {
+					regions[i] += other.regions[i];
+				}
+			}
+		};
+
+		// See orientation_bin in Sobel.cl
+		inline int orientationBin(int gx, int gy)
+		{
+			if (gy < 0 || (gy == 0 && gx < 0)) {
+				gx = -gx;
+				gy = -gy;
+			}
+
+			int ax = std::abs(gx);
+			if (gx > 0) {
+				if (gy * 32768 < ax * 13573)	return 0;
+				if (gy < ax)					return 1;
+				if (gy * 13573 < ax * 32768)	return 2;
+				return 3;
+			}
+
+			if (gy * 32768 <= ax * 13573)	return 7;
+			if (gy <= ax)					return 6;
+			if (gy * 13573 <= ax * 32768)	return 5;
+			return 4;
+		}
+
+		class StatsVisitor
+		{
+		public:
+			StatsVisitor(int width, int height, int edgeThreshold, StatsCounters& counters) :
+				height_(height),
+				edgeThreshold_(edgeThreshold),
+				columnRegion_(width),
+				counters_(counters)
+			{
+				for (int x = 0; x < width; ++x) {
+					columnRegion_[x] = x * EdgeStats::GRID / width;
+				}
+			}
+
+			inline void operator()(int x, int y, int gx, int gy)
+			{
+				int magnitude = stencil::Sobel::Combine::apply(gx, gy);
+
+				counters_.sum += magnitude;
+				if (magnitude >= edgeThreshold_) {
+					++counters_.edges;
+					++counters_.orientation[orientationBin(gx, gy)];
+					++counters_.regions[(y * EdgeStats::GRID / height_) * EdgeStats::GRID + columnRegion_[x]];
+				}
+			}
+
+		private:
+			int height_;
+			int edgeThreshold_;
+			std::vector<int> columnRegion_;
+			StatsCounters& counters_;
+		};
+
+		// Rows [rowBegin, rowEnd) of the OpenCL sobel magnitude : L1, clamped to the edge
+		void accumulateStats(const ConstPlane& src, int edgeThreshold, int rowBegin, int rowEnd, StatsCounters& counters)
+		{
+			StatsVisitor visitor(src.width, src.height, edgeThreshold, counters);
+			stencil::visitRows<stencil::Sobel, stencil::BorderReplicate>(src.data, src.stride, src.width, src.height, rowBegin, rowEnd, visitor);
+		}
+
+		void toEdgeStats(const StatsCounters& counters, int width, int height, EdgeStats& stats)
+		{
+			stats.edgePixels = (uint32_t)counters.edges;
+			stats.meanGradient = (double)counters.sum / ((double)width * height);
+			for (int i = 0; i < EdgeStats::ORIENTATION_BINS; ++i) {
+				stats.orientation[i] = (uint32_t)counters.orientation[i];
+			}
+
+			// Pixels per region row/column with the same integer split as the reduction
+			int regionWidth[EdgeStats::GRID] = {};
+			int regionHeight[EdgeStats::GRID] = {};
+			for (int x = 0; x < width; ++x) {
+				++regionWidth[x * EdgeStats::GRID / width];
+			}
+			for (int y = 0; y < height; ++y) {
+				++regionHeight[y * EdgeStats::GRID / height];
+			}
+
+			for (int ry = 0; ry < EdgeStats::GRID; ++ry) {
+				for (int rx = 0; rx < EdgeStats::GRID; ++rx) {
+					double area = (double)regionWidth[rx] * regionHeight[ry];
+					uint64_t edges = counters.regions[ry * EdgeStats::GRID + rx];
+					stats.regionDensity[ry][rx] = area > 0 ? (float)(edges / area) : 0.0f;
+				}
+			}
+		}
+
+		// Rows [rowBegin, rowEnd) of the colour Sobel, see Filter::processColor
+		void colorSobelRows(const ConstColorPlane& src, ColorCombine combine, const Plane& dst, int rowBegin, int rowEnd)
+		{
+			using namespace stencil;
+
+			if (combine == ColorCombine::Sum) {
+				applyInterleavedRows<Sobel, ChannelSum, 3, BorderReplicate>(src.data, src.stride, dst.data, dst.stride, src.width, src.height, rowBegin, rowEnd);
+			}
+			else {
+				applyInterleavedRows<Sobel, ChannelMax, 3, BorderReplicate>(src.data, src.stride, dst.data, dst.stride, src.width, src.height, rowBegin, rowEnd);
+			}
+		}
+
+		class CPUBackend : public Filter::Impl
+		{
+		public:
+			CPUBackend(int width, int height, const Options& options) :
+				stencil_(stencilFor(options.op).cpu),
+				cannyLowSquared_((uint32_t)(options.cannyLowThreshold * options.cannyLowThreshold)),
+				cannyHighSquared_((uint32_t)(options.cannyHighThreshold * options.cannyHighThreshold))
+			{
+				if (options.op == Operator::Canny) {
+					size_t numPixels = (size_t)width * height;
+					blurred_.resize(numPixels);
+					gradient_.resize(numPixels);
+					edges_.resize(numPixels);
+				}
+			}
+
+			double process(const ConstPlane& src, const Plane& dst) override
+			{
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+				if (stencil_ != nullptr) {
+					stencil_(src.data, src.stride, dst.data, dst.stride, src.width, src.height);
+				}
+				else {
+					canny(src, dst);
+				}
+
+				return elapsedMs(start);
+			}
+
+		private:
+			// The canny kernels of Sobel.cl on the host (simple_sobel.h) : the edges equal the
+			// OpenCL backend's, thresholds are squared the same way as in CLContext::canny
+			void canny(const ConstPlane& src, const Plane& dst)
+			{
+				const int width = src.width;
+				const int height = src.height;
+
+				canny_blur_operator(src.data, src.stride, &blurred_[0], width, height);
+				canny_gradient_operator(&blurred_[0], &gradient_[0], width, height);
+				canny_suppression_operator(&gradient_[0], &edges_[0], width, height, cannyLowSquared_, cannyHighSquared_);
+				canny_hysteresis_operator(&edges_[0], width, height, stack_);
+
+				for (int y = 0; y < height; ++y) {
+					memcpy(dst.data + dst.stride * y, &edges_[(size_t)width * y], width);
+				}
+			}
+
+			StencilFunc stencil_;
+			uint32_t cannyLowSquared_;
+			uint32_t cannyHighSquared_;
+			std::vector<pixel> blurred_;
+			std::vector<uint32_t> gradient_;
+			std::vector<pixel> edges_;
+			std::vector<int> stack_;
+		};
+
+		class OpenCVBackend : public Filter::Impl
+		{
+		public:
+			OpenCVBackend(const Options& options) :
+				op_(options.op),
+				cannyLow_(options.cannyLowThreshold),
+				cannyHigh_(options.cannyHighThreshold)
+			{
+				if (op_ != Operator::Sobel && op_ != Operator::Canny) {
+					throw std::invalid_argument(std::string("OpenCV backend does not support ") + operatorName(op_));
+				}
+			}
+
+			double process(const ConstPlane& src, const Plane& dst) override
+			{
+				// Headers only, the pixels stay in the caller's buffers
+				cv::Mat srcMat(src.height, src.width, CV_8UC1, const_cast<uchar*>(src.data), src.stride);
+				cv::Mat dstMat(dst.height, dst.width, CV_8UC1, dst.data, dst.stride);
+
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+				if (op_ == Operator::Canny) {
+					cv::GaussianBlur(srcMat, blurred_, cv::Size(5, 5), 0);
+					cv::Canny(blurred_, dstMat, cannyLow_, cannyHigh_, 3, true);
+
+					return elapsedMs(start);
+				}
+
+				/// Gradient X
+				cv::Sobel(srcMat, gradX_, CV_16S, 1, 0);
+				cv::convertScaleAbs(gradX_, absGradX_);
+
+				/// Gradient Y
+				cv::Sobel(srcMat, gradY_, CV_16S, 0, 1);
+				cv::convertScaleAbs(gradY_, absGradY_);
+
+				// Total Gradient (approximate)
+				cv::addWeighted(absGradX_, 0.5, absGradY_, 0.5, 0, dstMat);
+
+				return elapsedMs(start);
+			}
+
+		private:
+			Operator op_;
+			float cannyLow_;
+			float cannyHigh_;
+
+			// Kept across frames so that OpenCV reuses their allocations
+			cv::Mat gradX_, gradY_;
+			cv::Mat absGradX_, absGradY_;
+			cv::Mat blurred_;
+		};
+
+		// Output of OpenCVBackend's Sobel : reflected borders, |gx| and |gy| saturated and averaged
+		typedef stencil::Gradient<stencil::Taps<1, 2, 1>, stencil::Taps<-1, 0, 1>, stencil::HalfSumAbs> opencv_sobel_op;
+
+		// Computes |gx|, |gy| and their blend in one pass over the frame instead of
+		// OpenCV's five passes (2x Sobel, 2x convertScaleAbs, addWeighted) and four temporaries.
+		class OpenCVFusedBackend : public Filter::Impl
+		{
+		public:
+			OpenCVFusedBackend(const Options& options)
+			{
+				if (options.op != Operator::Sobel) {
+					throw std::invalid_argument(std::string("OpenCVFused backend does not support ") + operatorName(options.op));
+				}
+			}
+
+			double process(const ConstPlane& src, const Plane& dst) override
+			{
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+				// One stripe per thread, each stripe only reloads the radius rows above it
+				const int height = src.height;
+				const double numStripes = std::max(1, std::min(cv::getNumThreads(), height));
+				cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& range) {
+					stencil::applyRows<opencv_sobel_op, stencil::BorderReflect101>(
+						src.data, src.stride, dst.data, dst.stride, src.width, height, range.start, range.end);
+				}, numStripes);
+
+				return elapsedMs(start);
+			}
+
+			double analyze(const ConstPlane& src, int edgeThreshold, EdgeStats& stats) override
+			{
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+				StatsCounters total;
+				std::mutex mutex;
+				const int height = src.height;
+				const double numStripes = std::max(1, std::min(cv::getNumThreads(), height));
+				cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& range) {
+					StatsCounters counters;
+					accumulateStats(src, edgeThreshold, range.start, range.end, counters);
+
+					std::lock_guard<std::mutex> lock(mutex);
+					total.merge(counters);
+				}, numStripes);
+				toEdgeStats(total, src.width, height, stats);
+
+				return elapsedMs(start);
+			}
+
+			double processColor(const ConstColorPlane& src, ColorCombine combine, const Plane& dst) override
+			{
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+				const int height = src.height;
+				const double numStripes = std::max(1, std::min(cv::getNumThreads(), height));
+				cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& range) {
+					colorSobelRows(src, combine, dst, range.start, range.end);
+				}, numStripes);
+
+				return elapsedMs(start);
+			}
+		};
+
+		class OpenCLBackend : public Filter::Impl
+		{
+		public:
+			OpenCLBackend(int width, int height, const Options& options) :
+				op_(options.op),
+				cannyLow_(options.cannyLowThreshold),
+				cannyHigh_(options.cannyHighThreshold),
+				clContext_(createContext(width, height, options))
+			{
+				// Tiled frames keep the host pre-filter, the blur would need wider halos
+				if (options.blurSigma > 0.0f && !clContext_->tiles().tiled()) {
+					clContext_->enableBlur(options.clSourceDir + "/Gaussian.cl", gaussian::boxPlan(options.blurSigma));
+					deviceBlur_ = true;
+				}
+			}
+
+			double process(const ConstPlane& src, const Plane& dst) override
+			{
+				if (op_ == Operator::Canny) {
+					return clContext_->canny(src.data, src.stride, dst.data, dst.stride, cannyLow_, cannyHigh_);
+				}
+
+				return clContext_->filter(src.data, src.stride, dst.data, dst.stride);
+			}
+
+			double analyze(const ConstPlane& src, int edgeThreshold, EdgeStats& stats) override
+			{
+				cl_uint result[CLContext::STATS_SIZE];
+				double elapsed = clContext_->edgeStats(src.data, src.stride, edgeThreshold, result);
+
+				StatsCounters counters;
+				counters.edges = result[CLContext::STATS_EDGES];
+				counters.sum = ((uint64_t)result[CLContext::STATS_SUM_HIGH] << 32) | result[CLContext::STATS_SUM_LOW];
+				for (int i = 0; i < EdgeStats::ORIENTATION_BINS; ++i) {
+					counters.orientation[i] = result[CLContext::STATS_ORIENTATION + i];
+				}
+				for (int i = 0; i < STATS_REGIONS; ++i) {
+					counters.regions[i] = result[CLContext::STATS_REGIONS + i];
+				}
+				toEdgeStats(counters, src.width, src.height, stats);
+
+				return elapsed;
+			}
+
+			double processColor(const ConstColorPlane& src, ColorCombine combine, const Plane& dst) override
+			{
+				return clContext_->filterColor(src.data, src.stride, dst.data, dst.stride, combine == ColorCombine::Sum);
+			}
+
+			bool blursFrames() const override { return deviceBlur_; }
+
+			std::string device() const override { return clContext_->deviceName(); }
+
+		private:
+			static CLContext* createContext(int width, int height, const Options& options)
+			{
+				// Sobel and Canny live in Sobel.cl
+				StencilEntry entry = stencilFor(options.op);
+				if (entry.clOptions == nullptr) {
+					int halo = options.op == Operator::Canny ? CLContext::CANNY_HALO : entry.radius;
+					return new CLContext(width, height, options.clSourceDir + "/Sobel.cl", "sobel", "", halo, options.clMaxTileSize);
+				}
+
+				return new CLContext(width, height, options.clSourceDir + "/Stencil.cl", "stencil", entry.clOptions(), entry.radius, options.clMaxTileSize);
+			}
+
+			Operator op_;
+			float cannyLow_;
+			float cannyHigh_;
+			std::unique_ptr<CLContext> clContext_;
+			bool deviceBlur_ = false;
+		};
+
+		// Times every available backend on the live frames, runs the fastest one and
+		// benchmarks again when the resolution changes or the chosen backend slows down.
+		// Benchmark frames are real output, the caller never sees a gap.
+		class AutoBackend : public Filter::Impl
+		{
+		public:
+			AutoBackend(int width, int height, const Options& options) :
+				options_(options)
+			{
+				createCandidates(width, height);
+				startBenchmark("initial selection");
+			}
+
+			double process(const ConstPlane& src, const Plane& dst) override
+			{
+				return run(src.width, src.height,
+					[&](Filter& filter) { return filter.process(src, dst); },
+					[&](Filter& filter) { filter.process(src, scratch(src.width, src.height)); });
+			}
+
+			double analyze(const ConstPlane& src, int, EdgeStats& stats) override
+			{
+				EdgeStats probeStats;
+				return run(src.width, src.height,
+					[&](Filter& filter) { return filter.analyze(src, stats); },
+					[&](Filter& filter) { filter.analyze(src, probeStats); });
+			}
+
+			double processColor(const ConstColorPlane& src, ColorCombine, const Plane& dst) override
+			{
+				return run(src.width, src.height,
+					[&](Filter& filter) { return filter.processColor(src, dst); },
+					[&](Filter& filter) { filter.processColor(src, scratch(src.width, src.height)); });
+			}
+
+			bool blursFrames() const override { return true; }
+
+			std::string device() const override { return activeFilter_ != nullptr ? activeFilter_->device() : "none"; }
+
+			Backend active() const { return active_; }
+
+		private:
+			// Runs job on a width x height frame with the backend being benchmarked or the selected one.
+			// probe runs the same frame on another backend into scratch outputs, see probeNext().
+			template <class Job, class Probe>
+			double run(int width, int height, const Job& job, const Probe& probe)
+			{
+				if (width != width_ || height != height_) {
+					char reason[64];
+					snprintf(reason, sizeof(reason), "resolution changed to %dx%d", width, height);
+					createCandidates(width, height);
+					startBenchmark(reason);
+				}
+
+				Candidate& candidate = candidates_[benchmarking_ ? benchmarkIndex_ : selected_];
+				active_ = candidate.filter->backend();
+				activeFilter_ = candidate.filter.get();
+
+				double filterTime_ms = 0.0;
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				try {
+					filterTime_ms = job(*candidate.filter);
+				}
+				catch (const std::exception& e) {
+					dropCandidate(candidate, e.what());
+					return run(width, height, job, probe);
+				}
+				// Wall time, so that transfers count against OpenCL
+				double frameTime_ms = elapsedMs(start);
+
+				if (benchmarking_) {
+					recordSample(frameTime_ms);
+				}
+				else {
+					watchLoad(frameTime_ms);
+					if (probing_) {
+						probeNext(probe);
+					}
+				}
+
+				return filterTime_ms;
+			}
+
+			// Output plane for probes, only allocated once a periodic check starts
+			Plane scratch(int width, int height)
+			{
+				scratch_.resize((size_t)width * height);
+				return { &scratch_[0], width, height, (size_t)width };
+			}
+
+			// Frames run on a backend before it is timed (OpenCL program caches, OpenCV allocations)
+			static constexpr int WARMUP_FRAMES = 2;
+			static constexpr int SAMPLE_FRAMES = 8;
+			// Measure the others again when the chosen backend runs this much slower than when it was chosen...
+			static constexpr double SLOWDOWN_RATIO = 1.5;
+			// ...once it has run this many frames, so that a single hiccup does not trigger it
+			static constexpr int MIN_FRAMES_BETWEEN_CHECKS = 60;
+			// The others may have become faster in the meantime (e.g. the CPU became idle). The
+			// periodic check keeps the output on the selected backend and runs one extra frame
+			// on another backend every PROBE_INTERVAL frames, so a slow backend never stalls
+			// playback for more than a frame. Each check that changes nothing doubles the period.
+			static constexpr double RECHECK_PERIOD_MS = 10000.0;
+			static constexpr double MAX_RECHECK_PERIOD_MS = 160000.0;
+			static constexpr int PROBE_INTERVAL = 8;
+
+			struct Candidate
+			{
+				std::unique_ptr<Filter> filter;
+				std::vector<double> samples;
+				double median_ms;
+			};
+
+			void log(const std::string& message)
+			{
+				if (options_.log) {
+					options_.log(message);
+				}
+			}
+
+			void createCandidates(int width, int height)
+			{
+				const Backend backends[] = { Backend::CPU, Backend::OpenCV, Backend::OpenCL, Backend::OpenCVFused };
+
+				width_ = width;
+				height_ = height;
+				candidates_.clear();
+				for (Backend backend : backends) {
+					try {
+						Candidate candidate;
+						candidate.filter.reset(new Filter(backend, width, height, options_));
+						candidate.median_ms = 0.0;
+						candidates_.push_back(std::move(candidate));
+					}
+					catch (const std::exception& e) {
+						log(std::string("Auto : skipping ") + backendName(backend) + " (" + e.what() + ")");
+					}
+				}
+
+				if (candidates_.empty()) {
+					throw std::invalid_argument(std::string("No backend supports ") + operatorName(options_.op));
+				}
+				active_ = candidates_[0].filter->backend();
+				activeFilter_ = candidates_[0].filter.get();
+			}
+
+			void dropCandidate(Candidate& candidate, const char* error)
+			{
+				log(std::string("Auto : dropping ") + backendName(candidate.filter->backend()) + " after an error (" + error + ")");
+
+				candidates_.erase(candidates_.begin() + (&candidate - &candidates_[0]));
+				if (candidates_.empty()) {
+					activeFilter_ = nullptr;
+					throw std::runtime_error("Auto : every backend failed");
+				}
+				active_ = candidates_[0].filter->backend();
+				activeFilter_ = candidates_[0].filter.get();
+				startBenchmark("a backend failed");
+			}
+
+			void startBenchmark(const std::string& reason)
+			{
+				log("Auto : benchmarking " + std::to_string(candidates_.size()) + " backends at " +
+					std::to_string(width_) + "x" + std::to_string(height_) + ", " + reason);
+
+				for (Candidate& candidate : candidates_) {
+					candidate.samples.clear();
+				}
+				benchmarking_ = true;
+				benchmarkIndex_ = 0;
+				frameCount_ = 0;
+				probing_ = false;
+				recheckPeriod_ms_ = RECHECK_PERIOD_MS;
+			}
+
+			void startProbe(const std::string& reason)
+			{
+				char message[96];
+				snprintf(message, sizeof(message), "Auto : measuring %d other backends, one frame every %d frames, ",
+					(int)candidates_.size() - 1, PROBE_INTERVAL);
+				log(message + reason);
+
+				for (Candidate& candidate : candidates_) {
+					candidate.samples.clear();
+				}
+				probing_ = true;
+				probeIndex_ = nextProbe(0);
+				probeRuns_ = 0;
+				probeFrames_ = 0;
+			}
+
+			size_t nextProbe(size_t index) const
+			{
+				return index == selected_ ? index + 1 : index;
+			}
+
+			// The selected backend has already produced the frame, the probe result is discarded
+			template <class Probe>
+			void probeNext(const Probe& probe)
+			{
+				if (++probeFrames_ < PROBE_INTERVAL) {
+					return;
+				}
+				probeFrames_ = 0;
+
+				Candidate& candidate = candidates_[probeIndex_];
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				try {
+					probe(*candidate.filter);
+				}
+				catch (const std::exception& e) {
+					dropCandidate(candidate, e.what());
+					return;
+				}
+				double frameTime_ms = elapsedMs(start);
+
+				if (++probeRuns_ > WARMUP_FRAMES) {
+					candidate.samples.push_back(frameTime_ms);
+				}
+				if (probeRuns_ < WARMUP_FRAMES + SAMPLE_FRAMES) {
+					return;
+				}
+				candidate.median_ms = median(candidate.samples);
+
+				probeRuns_ = 0;
+				probeIndex_ = nextProbe(probeIndex_ + 1);
+				if (probeIndex_ < candidates_.size()) {
+					return;
+				}
+
+				// The selected backend competes with its current frame time
+				Backend previous = selectedBackend_;
+				double period_ms = recheckPeriod_ms_;
+				candidates_[selected_].median_ms = average_ms_;
+				probing_ = false;
+				select();
+				// std::min takes references : pass a copy, the constant has no out-of-class definition
+				const double maxPeriod_ms = MAX_RECHECK_PERIOD_MS;
+				recheckPeriod_ms_ = selectedBackend_ == previous ? std::min(2.0 * period_ms, maxPeriod_ms) : RECHECK_PERIOD_MS;
+			}
+
+			static double median(std::vector<double>& samples)
+			{
+				// Robust to the odd preempted frame
+				std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+				return samples[samples.size() / 2];
+			}
+
+			void recordSample(double frameTime_ms)
+			{
+				Candidate& candidate = candidates_[benchmarkIndex_];
+				if (++frameCount_ > WARMUP_FRAMES) {
+					candidate.samples.push_back(frameTime_ms);
+				}
+				if (frameCount_ < WARMUP_FRAMES + SAMPLE_FRAMES) {
+					return;
+				}
+
+				candidate.median_ms = median(candidate.samples);
+
+				frameCount_ = 0;
+				if (++benchmarkIndex_ == candidates_.size()) {
+					select();
+				}
+			}
+
+			void select()
+			{
+				size_t best = 0;
+				for (size_t i = 1; i < candidates_.size(); ++i) {
+					if (candidates_[i].median_ms < candidates_[best].median_ms) {
+						best = i;
+					}
+				}
+
+				Backend chosen = candidates_[best].filter->backend();
+				std::string message = "Auto : ";
+				if (hasSelection_ && chosen != selectedBackend_) {
+					message += std::string("switching from ") + backendName(selectedBackend_) + " to ";
+				}
+				else {
+					message += "selected ";
+				}
+				message += std::string(backendName(chosen)) + " (";
+				for (size_t i = 0; i < candidates_.size(); ++i) {
+					char entry[64];
+					snprintf(entry, sizeof(entry), "%s%s %.2f ms", i > 0 ? ", " : "", backendName(candidates_[i].filter->backend()), candidates_[i].median_ms);
+					message += entry;
+				}
+				log(message + ")");
+
+				selected_ = best;
+				selectedBackend_ = chosen;
+				hasSelection_ = true;
+				benchmarking_ = false;
+				baseline_ms_ = candidates_[best].median_ms;
+				average_ms_ = baseline_ms_;
+				frameCount_ = 0;
+				selectedAt_ = std::chrono::steady_clock::now();
+			}
+
+			void watchLoad(double frameTime_ms)
+			{
+				// Exponential moving average over roughly the last 16 frames
+				average_ms_ += (frameTime_ms - average_ms_) / 16.0;
+				if (++frameCount_ < MIN_FRAMES_BETWEEN_CHECKS) {
+					return;
+				}
+
+				if (candidates_.size() < 2 || probing_) {
+					return;
+				}
+				if (average_ms_ > baseline_ms_ * SLOWDOWN_RATIO) {
+					char reason[128];
+					snprintf(reason, sizeof(reason), "%s slowed down from %.2f ms to %.2f ms per frame",
+						backendName(selectedBackend_), baseline_ms_, average_ms_);
+					startProbe(reason);
+				}
+				else if (elapsedMs(selectedAt_) > recheckPeriod_ms_) {
+					startProbe("periodic check");
+				}
+			}
+
+			Options options_;
+			int width_ = 0;
+			int height_ = 0;
+			std::vector<Candidate> candidates_;
+			Backend active_ = Backend::CPU;
+			const Filter* activeFilter_ = nullptr;
+
+			bool benchmarking_ = false;
+			size_t benchmarkIndex_ = 0;
+			int frameCount_ = 0;
+
+			bool hasSelection_ = false;
+			size_t selected_ = 0;
+			Backend selectedBackend_ = Backend::CPU;
+			double baseline_ms_ = 0.0;
+			double average_ms_ = 0.0;
+			std::chrono::steady_clock::time_point selectedAt_;
+			double recheckPeriod_ms_ = RECHECK_PERIOD_MS;
+
+			bool probing_ = false;
+			size_t probeIndex_ = 0;
+			int probeRuns_ = 0;
+			int probeFrames_ = 0;
+			std::vector<uchar> scratch_;
+		};
+
+		void checkPlane(const char* name, const uchar* data, int width, int height, size_t stride, int expectedWidth, int expectedHeight, int bytesPerPixel = 1)
+		{
+			if (data == nullptr) {
+				throw std::invalid_argument(std::string(name) + " plane has no data");
+			}
+			if (width != expectedWidth || height != expectedHeight) {
+				throw std::invalid_argument(std::string(name) + " plane size does not match the filter size");
+			}
+			if (stride < (size_t)width * bytesPerPixel) {
+				throw std::invalid_argument(std::string(name) + " plane stride is smaller than its row size");
+			}
+		}
+	}
+
+	double Filter::Impl::analyze(const ConstPlane& src, int edgeThreshold, EdgeStats& stats)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		StatsCounters counters;
+		accumulateStats(src, edgeThreshold, 0, src.height, counters);
+		toEdgeStats(counters, src.width, src.height, stats);
+
+		return elapsedMs(start);
+	}
+
+	void Filter::Impl::enableHostBlur(float sigma, int width, int height)
+	{
+		blur_.reset(new gaussian::BoxBlur(sigma, width, height));
+		blurred_.resize((size_t)width * height);
+	}
+
+	ConstPlane Filter::Impl::prefilter(const ConstPlane& src, double& elapsed)
+	{
+		if (!blur_) {
+			return src;
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		blur_->apply(src.data, src.stride, &blurred_[0], src.width);
+		elapsed += elapsedMs(start);
+
+		return ConstPlane{ &blurred_[0], src.width, src.height, (size_t)src.width };
+	}
+
+	double Filter::Impl::processColor(const ConstColorPlane& src, ColorCombine combine, const Plane& dst)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		colorSobelRows(src, combine, dst, 0, src.height);
+
+		return elapsedMs(start);
+	}
+
+	const char* backendName(Backend backend)
+	{
+		switch (backend) {
+		case Backend::CPU:		return "CPU";
+		case Backend::OpenCV:	return "OpenCV";
+		case Backend::OpenCL:	return "OpenCL";
+		case Backend::OpenCVFused:	return "OpenCV Fused";
+		case Backend::Auto:		return "Auto";
+		}
+
+		return "";
+	}
+
+	const char* operatorName(Operator op)
+	{
+		switch (op) {
+		case Operator::Sobel:		return "Sobel";
+		case Operator::Scharr:		return "Scharr";
+		case Operator::Prewitt:		return "Prewitt";
+		case Operator::Gaussian3x3:	return "Gaussian3x3";
+		case Operator::Gaussian5x5:	return "Gaussian5x5";
+		case Operator::Laplacian:	return "Laplacian";
+		case Operator::Canny:		return "Canny";
+		}
+
+		return "";
+	}
+
+	bool parseBackend(const char* name, Backend& backend)
+	{
+		struct { const char* name; Backend backend; } backends[] = {
+			{ "CPU", Backend::CPU }, { "OpenCV", Backend::OpenCV },
+			{ "OpenCL", Backend::OpenCL }, { "Fused", Backend::OpenCVFused },
+			{ "Auto", Backend::Auto }
+		};
+
+		for (const auto& candidate : backends) {
+			if (strcmp(name, candidate.name) == 0) {
+				backend = candidate.backend;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool parseOperator(const char* name, Operator& op)
+	{
+		const Operator operators[] = {
+			Operator::Sobel, Operator::Scharr, Operator::Prewitt,
+			Operator::Gaussian3x3, Operator::Gaussian5x5, Operator::Laplacian, Operator::Canny
+		};
+
+		for (Operator candidate : operators) {
+			if (strcmp(name, operatorName(candidate)) == 0) {
+				op = candidate;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	ResourceUsage resourceUsage()
+	{
+		const cl::HandleCounters& handles = cl::handleCounters();
+		const cl::TransferCounters& transfers = cl::transferCounters();
+
+		ResourceUsage usage;
+		usage.clBytesUploaded = transfers.uploaded.load(std::memory_order_relaxed);
+		usage.clBytesDownloaded = transfers.downloaded.load(std::memory_order_relaxed);
+		usage.clMemoryBytes = handles.memBytes.load();
+		usage.clObjects = 0;
+		for (int i = 0; i < cl::HANDLE_KIND_COUNT; ++i) {
+			usage.clObjects += handles.created[i] - handles.released[i];
+		}
+
+		return usage;
+	}
+
+	std::string resourceReport()
+	{
+		return cl::handleReport();
+	}
+
+	Filter::Filter(Backend backend, int width, int height, const Options& options) :
+		backend_(backend),
+		op_(options.op),
+		width_(width),
+		height_(height),
+		edgeThreshold_(options.edgeThreshold),
+		colorCombine_(options.colorCombine)
+	{
+		if (width < 1 || height < 1) {
+			throw std::invalid_argument("Filter size must be positive");
+		}
+		if (edgeThreshold_ < 1 || edgeThreshold_ > 255) {
+			throw std::invalid_argument("Edge threshold must be within 1..255");
+		}
+		if (!(options.blurSigma >= 0.0f && options.blurSigma <= gaussian::MAX_SIGMA)) {
+			throw std::invalid_argument("Blur sigma must be within 0..32");
+		}
+
+		try {
+			switch (backend) {
+			case Backend::CPU:		impl_.reset(new CPUBackend(width, height, options));	break;
+			case Backend::OpenCV:	impl_.reset(new OpenCVBackend(options));				break;
+			case Backend::OpenCL:	impl_.reset(new OpenCLBackend(width, height, options));	break;
+			case Backend::OpenCVFused:	impl_.reset(new OpenCVFusedBackend(options));		break;
+			case Backend::Auto:		impl_.reset(new AutoBackend(width, height, options));	break;
+			}
+		}
+		catch (const std::invalid_argument&) {
+			throw;
+		}
+		catch (const std::exception& e) {
+			throw std::runtime_error(e.what());
+		}
+
+		if (!impl_) {
+			throw std::invalid_argument("Unknown backend");
+		}
+		if (options.blurSigma > 0.0f && !impl_->blursFrames()) {
+			impl_->enableHostBlur(options.blurSigma, width, height);
+		}
+	}
+
+	Filter::~Filter()
+	{
+	}
+
+	double Filter::process(const ConstPlane& src, const Plane& dst)
+	{
+		followSize(src.width, src.height);
+
+		checkPlane("Source", src.data, src.width, src.height, src.stride, width_, height_);
+		checkPlane("Destination", dst.data, dst.width, dst.height, dst.stride, width_, height_);
+
+		double elapsed = 0.0;
+		ConstPlane input = impl_->prefilter(src, elapsed);
+
+		return elapsed + impl_->process(input, dst);
+	}
+
+	double Filter::analyze(const ConstPlane& src, EdgeStats& stats)
+	{
+		if (op_ != Operator::Sobel) {
+			throw std::invalid_argument(std::string("Edge statistics are not available for ") + operatorName(op_));
+		}
+
+		followSize(src.width, src.height);
+		checkPlane("Source", src.data, src.width, src.height, src.stride, width_, height_);
+
+		double elapsed = 0.0;
+		ConstPlane input = impl_->prefilter(src, elapsed);
+
+		return elapsed + impl_->analyze(input, edgeThreshold_, stats);
+	}
+
+	double Filter::processColor(const ConstColorPlane& src, const Plane& dst)
+	{
+		if (op_ != Operator::Sobel) {
+			throw std::invalid_argument(std::string("Colour edges are not available for ") + operatorName(op_));
+		}
+
+		followSize(src.width, src.height);
+		checkPlane("Source", src.data, src.width, src.height, src.stride, width_, height_, 3);
+		checkPlane("Destination", dst.data, dst.width, dst.height, dst.stride, width_, height_);
+
+		return impl_->processColor(src, colorCombine_, dst);
+	}
+
+	void Filter::followSize(int width, int height)
+	{
+		if (backend_ == Backend::Auto && width > 0 && height > 0) {
+			// AutoBackend rebuilds its backends for the new size
+			width_ = width;
+			height_ = height;
+		}
+	}
+
+	Backend Filter::activeBackend() const
+	{
+		if (backend_ == Backend::Auto) {
+			return static_cast<const AutoBackend*>(impl_.get())->active();
+		}
+
+		return backend_;
+	}
+
+	std::string Filter::device() const
+	{
+		return impl_->device();
+	}
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+// libvivante : edge detection over caller-owned 8-bit planes.
+//
+// The library never allocates or owns frame memory. Input and output planes
+// are described by a pointer, a size and a row stride, and each backend reads
+// and writes them in place:
+//   CPU    : operates directly on the planes.
+//   OpenCV : wraps the planes in cv::Mat headers, intermediates are reused across frames.
+//   OpenCL : uploads/downloads the planes with their row pitch, without a staging copy.
+//   OpenCVFused : same output as OpenCV's Sobel, computed in a single cv::parallel_for_ pass.
+//   Auto   : benchmarks the other backends on the live frames and runs the fastest one.
+namespace vivante
+{
+	typedef unsigned char uchar;
+
+	enum class Backend : int
+	{
+		CPU,
+		OpenCV,
+		OpenCL,
+		OpenCVFused,
+		Auto
+	};
+
+	// Edge/smoothing operator. Scharr, Prewitt, Gaussian and Laplacian are generated by the
+	// stencil engine (stencil.h / Stencil.cl) and are only available on CPU and OpenCL.
+	enum class Operator : int
+	{
+		Sobel,
+		Scharr,
+		Prewitt,
+		Gaussian3x3,
+		Gaussian5x5,
+		Laplacian,
+		Canny
+	};
+
+	// Read-only 8-bit single channel plane. stride is in bytes and must be >= width.
+	struct ConstPlane
+	{
+		const uchar* data;
+		int width;
+		int height;
+		size_t stride;
+	};
+
+	// Writable 8-bit single channel plane. stride is in bytes and must be >= width.
+	struct Plane
+	{
+		uchar* data;
+		int width;
+		int height;
+		size_t stride;
+	};
+
+	// Read-only interleaved 8-bit BGR plane, 3 bytes per pixel. stride is in bytes and must be >= 3 * width.
+	struct ConstColorPlane
+	{
+		const uchar* data;
+		int width;
+		int height;
+		size_t stride;
+	};
+
+	// How Filter::processColor merges the edge magnitudes of the three channels
+	enum class ColorCombine : int
+	{
+		Max,	// strongest channel, the output stays in the range of a grey edge map
+		Sum		// all channels, saturated : weak edges present in several channels add up
+	};
+
+	struct Options
+	{
+		Operator op = Operator::Sobel;
+
+		// Operator::Canny thresholds on the gradient magnitude
+		float cannyLowThreshold = 0.2f * 256;
+		float cannyHighThreshold = 0.8f * 256;
+
+		// Directory holding Sobel.cl, Stencil.cl and Gaussian.cl, only used by Backend::OpenCL.
+		std::string clSourceDir = ".";
+
+		// Backend::OpenCL splits frames beyond the device image limits into tiles.
+		// A positive value caps the tile width and height further (0 : device limits).
+		int clMaxTileSize = 0;
+
+		// Filter::analyze counts a pixel as an edge when its Sobel magnitude is at least this (1..255)
+		int edgeThreshold = 64;
+
+		// Filter::processColor channel merge
+		ColorCombine colorCombine = ColorCombine::Max;
+
+		// Gaussian pre-filter applied by Filter::process and Filter::analyze before the operator,
+		// e.g. for noisy low-light frames (0 : off, up to 32). The cost does not depend on sigma;
+		// gaussian.h describes the approximation and its accuracy. OpenCL blurs on the device.
+		float blurSigma = 0.0f;
+
+		// Called by Backend::Auto with the reason of every benchmark and backend switch
+		std::function<void(const std::string&)> log;
+	};
+
+	// Per-frame statistics of the Sobel edge map, see Filter::analyze.
+	// The magnitude is min(|gx| + |gy|, 255) with replicated borders, as produced by
+	// the OpenCL Sobel kernel, so every backend reports identical numbers.
+	struct EdgeStats
+	{
+		static constexpr int GRID = 8;
+		static constexpr int ORIENTATION_BINS = 8;
+
+		uint32_t edgePixels;						// pixels with magnitude >= Options::edgeThreshold
+		double meanGradient;						// mean magnitude over the whole frame
+		float regionDensity[GRID][GRID];			// fraction of edge pixels in each region, [row][column]
+		uint32_t orientation[ORIENTATION_BINS];		// edge pixels per 22.5 degree bin of the gradient direction,
+													// [0, 180) from +x towards +y (down)
+	};
+
+	const char* backendName(Backend backend);
+	const char* operatorName(Operator op);
+
+	// Command line names : operatorName() for operators, and CPU, OpenCV, OpenCL, Fused
+	// and Auto for backends. Return false and leave the output unchanged for anything else.
+	bool parseBackend(const char* name, Backend& backend);
+	bool parseOperator(const char* name, Operator& op);
+
+	// Process-wide OpenCL usage of every Filter so far, safe to read from any thread
+	struct ResourceUsage
+	{
+		uint64_t clBytesUploaded;	// host to device
+		uint64_t clBytesDownloaded;	// device to host
+		int64_t clMemoryBytes;		// live buffers and images
+		long clObjects;				// live OpenCL objects of any type
+	};
+
+	ResourceUsage resourceUsage();
+
+	// Live/created OpenCL objects of every Filter so far, e.g. "context 1/1, ..., event 0/5400".
+	// Anything but 0 live objects after all filters are destroyed is a leak.
+	std::string resourceReport();
+
+	class Filter
+	{
+	public:
+		// Throws std::invalid_argument if the backend does not support options.op,
+		// std::runtime_error if the backend can not be initialized.
+		Filter(Backend backend, int width, int height, const Options& options = Options());
+		~Filter();
+
+		Filter(const Filter&) = delete;
+		Filter& operator=(const Filter&) = delete;
+
+		// Runs edge detection on src and writes the result into dst.
+		// Both planes must match the size given at construction and must not overlap,
+		// except with Backend::Auto which follows resolution changes (dst must match src).
+		// Returns the time spent in the filter itself in milliseconds.
+		double process(const ConstPlane& src, const Plane& dst);
+
+		// Sobel edge detection on every channel of a BGR frame, so that edges between colours
+		// of similar brightness are kept. The per-channel magnitude is min(|gx| + |gy|, 255) with
+		// replicated borders (the OpenCL Sobel kernel), merged by Options::colorCombine; a grey
+		// frame gives the OpenCL Sobel output on every backend. Requires Operator::Sobel.
+		// CPU and OpenCV run one interleaved pass, OpenCVFused splits it into stripes and
+		// OpenCL uploads the frame as is and runs a single kernel on all three channels.
+		// Options::blurSigma does not apply to colour frames.
+		// Returns the time spent in the filter itself in milliseconds.
+		double processColor(const ConstColorPlane& src, const Plane& dst);
+
+		// Computes EdgeStats of src without producing the edge map. OpenCL reduces them on
+		// the device and only reads back the counters. Requires Operator::Sobel.
+		// Returns the time spent in the filter itself in milliseconds.
+		double analyze(const ConstPlane& src, EdgeStats& stats);
+
+		Backend backend() const { return backend_; }
+		// The backend that processed the last frame, differs from backend() only for Backend::Auto
+		Backend activeBackend() const;
+		// Where activeBackend() runs : "host", or the OpenCL device name and type, e.g. "pthread-cpu (CPU)"
+		std::string device() const;
+		Operator op() const { return op_; }
+		int width() const { return width_; }
+		int height() const { return height_; }
+
+		class Impl;
+
+	private:
+		void followSize(int width, int height);
+
+		Backend backend_;
+		Operator op_;
+		int width_;
+		int height_;
+		int edgeThreshold_;
+		ColorCombine colorCombine_;
+		std::unique_ptr<Impl> impl_;
+	};
+}